@@ -3,16 +3,29 @@
 #include <functional>
 #include <string>
 #include <map>
+#include "sampling.h"
 
 enum Action {Infection, Recovery};
 
 struct InfectivityProfile {
     double max_function_value;
     std::function<double(double)> infectivity_function;
+    // Optional O(1) sampler of tau from the profile normalized over its support [0, support_end];
+    // when set, contact times are drawn directly instead of by thinning.
+    std::function<double()> sampler = {};
+    double support_integral = 0; // integral of infectivity_function over the whole support
+};
+
+/// Everything a Simulation is built from besides its config.
+struct Model {
+    InfectivityProfile infectivity;
+    std::function<double(double)> susceptibility;
+    epi::RecoverySampler recovery;
 };
 
 struct node {
     int index;
+    int exposures; // infection attempts so far (keys the per-event RNG substream in CRN mode)
     double infectivity;
     double susceptibility;
     double last_recovery_time;
@@ -31,6 +44,14 @@ struct event {
 };
 
 
+/// One output row: `cases` on `day`, `infected` nodes when the day ends, mean susceptibility over the day.
+struct DayStats {
+    int day;
+    int cases;
+    int infected;
+    double avg_susceptibility;
+};
+
 struct config {
     int N;
     double t_max;
@@ -50,4 +71,13 @@ struct config {
     int n_initial; // initial infected
     double susc_initial; // initial susceptibility
     std::string output_file;
+    bool quiet; // do not echo daily statistics to stdout
+
+    double contact_cache_quantum; // recovery-length quantum of the contact time cache, 0 disables it
+    int contact_cache_entries;
+
+    uint64_t seed;   // RNG seed; replicas of one seed differ by stream
+    uint64_t stream; // RNG stream id of this run (replica index)
+    bool crn;        // common random numbers: every infection attempt draws from its own (node, attempt) substream
+    bool antithetic; // complement every random word (the antithetic twin of the same seed and stream)
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "util.h"
+
+/// Uniform random choice of contacts among `population` nodes: Lemire's multiply-shift mapping of 64-bit random
+/// words, with the rejection threshold computed once so no division happens per draw. Batches take their words
+/// from one bulk RNG fill and return indices only, so choosing a contact never touches the node records.
+class ContactSelector {
+public:
+    explicit ContactSelector(int population)
+        : population_((uint64_t) population), threshold_(population > 0 ? (0 - population_) % population_ : 0) {}
+
+    [[nodiscard]] int population() const { return (int) population_; }
+
+    [[nodiscard]] int operator()() const {
+        return (int) epi::uniform_index(population_, threshold_);
+    }
+
+    /// Fills out[0..n) with independent uniform indices.
+    void select(int *out, size_t n) const {
+        static_assert(sizeof(uint64_t) >= sizeof(int));
+        words_.resize(n);
+        epi::random_words(words_.data(), n);
+        for (size_t i = 0; i < n; i++) {
+            __uint128_t m = (__uint128_t) words_[i] * population_;
+            if ((uint64_t) m < threshold_) {
+                out[i] = (*this)();
+            } else {
+                out[i] = (int) (m >> 64);
+            }
+        }
+    }
+
+    /// Starts loading the record at `index` into cache ahead of its use, e.g. that of the next event's node.
+    template <class Records>
+    static void prefetch(const Records &records, int index) {
+        __builtin_prefetch(&records[index], 1);
+    }
+
+private:
+    uint64_t population_;
+    uint64_t threshold_;
+    mutable std::vector<uint64_t> words_; // scratch for batches
+};
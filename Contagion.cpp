@@ -0,0 +1,118 @@
+#include "Contagion.h"
+#include <algorithm>
+#include <unordered_set>
+#include <utility>
+#include "NodeStore.h"
+#include "util.h"
+
+Contagion::Contagion(const config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel)
+    : Contagion(cfg, std::move(kernel), model.susceptibility, model.recovery, true) {}
+
+Contagion::Contagion(const config& cfg, std::shared_ptr<const epi::Kernel> kernel,
+                     std::function<double(double)> susceptibility, epi::RecoverySampler recovery, bool substreams)
+    : cfg_(cfg),
+      kernel_(std::move(kernel)),
+      susceptibility_func_(std::move(susceptibility)),
+      recovery_func_(std::move(recovery)),
+      substreams_(substreams),
+      contact_selector_(cfg.N) {}
+
+void Contagion::resize() {
+    if (contact_selector_.population() != cfg_.N) {
+        contact_selector_ = ContactSelector(cfg_.N);
+    }
+}
+
+Contagion::Attempt Contagion::attempt(node& target, int index, double time) {
+    // The k-th attempt on a node consumes the same random numbers in every CRN run of this seed and stream,
+    // whatever the parameters, so runs of a sweep stay coupled event by event
+    Attempt result = {(uint64_t) (uint32_t) (index + 1) << 32 | (uint32_t) target.exposures++, false, 0};
+    if (substreams_ || cfg_.crn) {
+        epi::reseed(cfg_.seed, epi::substream(cfg_.stream, result.key));
+    }
+    double tau = time - target.last_recovery_time;
+    double susceptibility_value;
+    if (index == -1) {
+        susceptibility_value = target.susceptibility;
+    } else if (target.last_recovery_time <= 0 && target.recovery_count == 0) {
+        susceptibility_value = cfg_.susc_initial;
+    } else {
+        susceptibility_value = tau > 0 ? susceptibility_func_(tau) : 0;
+    }
+    if (epi::uniform() > susceptibility_value) {
+        return result;
+    }
+
+    result.infected = true;
+    target.infected = true;
+    result.recovery_length = recovery_func_(time);
+    if (index >= 0) {
+        target.last_recovery_time = time + result.recovery_length;
+        target.recovery_count++;
+    }
+    return result;
+}
+
+void Contagion::spread(const Attempt& a, double time) {
+    delays_ = kernel_->inf_times(cfg_.beta, a.recovery_length);
+    delays_.erase(std::remove_if(delays_.begin(), delays_.end(),
+                                 [&](double t_inf) { return time + t_inf > cfg_.t_max; }),
+                  delays_.end());
+    if (substreams_ || cfg_.crn) {
+        // Contacts get their own substream: a parameter change that adds or drops a contact time
+        // must not shift which nodes the other contacts reach
+        epi::reseed(cfg_.seed, epi::substream(epi::substream(cfg_.stream, a.key), 1));
+    }
+    contacts_.resize(delays_.size());
+    contact_selector_.select(contacts_.data(), delays_.size());
+}
+
+Contagion::Tally Contagion::tally(const node *nodes, size_t n, int day) const {
+    Tally result;
+    const double time = (double) (day - 1);
+    for (size_t b = 0; b < n; b += NodeStore::block_size) {
+        double sum = 0;
+        for (size_t i = b; i < std::min(n, b + NodeStore::block_size); i++) {
+            if (nodes[i].infected) {
+                result.infected++;
+            }
+            sum += nodes[i].recovery_count == 0 ? cfg_.susc_initial
+                                                : susceptibility_func_(time - nodes[i].last_recovery_time);
+        }
+        result.susceptibility.push_back(sum);
+    }
+    return result;
+}
+
+std::vector<int> Contagion::initial_infections(const config& cfg, const ContactSelector& selector) {
+    const int count = std::min(cfg.n_initial, cfg.N);
+    std::vector<int> initial;
+    std::unordered_set<int> chosen;
+    initial.reserve((size_t) std::max(count, 0));
+    chosen.reserve((size_t) std::max(count, 0));
+    while ((int) initial.size() < count) {
+        int i = selector();
+        if (chosen.insert(i).second) {
+            initial.push_back(i);
+        }
+    }
+    return initial;
+}
+
+std::vector<event> Contagion::start_events(const config& cfg) {
+    epi::BlockRng rng(cfg.seed, cfg.stream);
+    rng.set_antithetic(cfg.antithetic);
+    epi::RngScope scope(rng);
+    std::vector<event> events;
+    for (int i : initial_infections(cfg, ContactSelector(cfg.N))) {
+        events.push_back({0.0, i, Infection});
+    }
+    double t = 0;
+    while (t < cfg.t_max) {
+        t = t + 1 / cfg.sp_lambda;
+        if (t < cfg.t_max) {
+            events.push_back({t, -1, Infection});
+        }
+    }
+    return events;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "ContactSelector.h"
+#include "Kernel.h"
+
+/// The infection rules of the event-driven engines. Simulation draws an attempt from the run's stream, or in --crn
+/// mode from the attempt's own (node, exposure) substream; the parallel engines (Partition, the Time Warp
+/// partitions, RelaxedSimulation and through Partition DistributedSimulation) always use the substreams, so every
+/// engine gives a node the same history whichever thread or rank processes it. The engines only differ in where
+/// the resulting events go. Holds scratch: one per thread.
+class Contagion {
+public:
+    Contagion(const config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel);
+
+    /// With `substreams` false, attempts draw from the thread's RNG as it stands unless cfg.crn is set.
+    Contagion(const config& cfg, std::shared_ptr<const epi::Kernel> kernel,
+              std::function<double(double)> susceptibility, epi::RecoverySampler recovery, bool substreams);
+
+    /// Outcome of an infection attempt.
+    struct Attempt {
+        uint64_t key;           // (node + 1) << 32 | exposure, the attempt's substream
+        bool infected;
+        double recovery_length; // of the infection, if infected
+    };
+
+    /// Attempts to infect `target` (node `index`, -1 for the tourist) at `time`: counts the exposure and, if the
+    /// node is infected, marks it and (unless it is the tourist) sets its recovery time and count.
+    Attempt attempt(node& target, int index, double time);
+
+    /// Draws the contacts of the infection `a` at `time` that fall by t_max: their delays after `time` in
+    /// delays() and the contacted nodes in contacts(). Must follow attempt() with no other draws in between.
+    void spread(const Attempt& a, double time);
+
+    [[nodiscard]] const std::vector<double>& delays() const { return delays_; }
+    [[nodiscard]] const std::vector<int>& contacts() const { return contacts_; }
+
+    /// Index of a uniformly chosen contact.
+    int select_contact() { return contact_selector_(); }
+
+    [[nodiscard]] const ContactSelector& contact_selector() const { return contact_selector_; }
+
+    /// Follows a change of cfg.N since construction (see Simulation::reset).
+    void resize();
+
+    /// A share of the statistics row of day `day` - 1 (see Simulation::day_stats).
+    struct Tally {
+        int infected = 0;
+        std::vector<double> susceptibility; // sums over NodeStore blocks, in order
+    };
+
+    /// The tally of the nodes[0..n), which start on a NodeStore block boundary.
+    [[nodiscard]] Tally tally(const node *nodes, size_t n, int day) const;
+
+    /// The distinct nodes infected at time 0, drawn from the thread's RNG with `selector` as Simulation::start()
+    /// draws them.
+    static std::vector<int> initial_infections(const config& cfg, const ContactSelector& selector);
+
+    /// The events starting a run: its initial infections, placed with the run's own stream, then the
+    /// deterministic spontaneous infections through the tourist node, as in Simulation::start().
+    static std::vector<event> start_events(const config& cfg);
+
+private:
+    const config& cfg_;
+    std::shared_ptr<const epi::Kernel> kernel_;
+    std::function<double(double)> susceptibility_func_;
+    epi::RecoverySampler recovery_func_;
+    bool substreams_;
+
+    ContactSelector contact_selector_; // over the whole population
+    std::vector<double> delays_;
+    std::vector<int> contacts_;
+};
@@ -0,0 +1,113 @@
+#include "DayStepSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include "Contagion.h"
+#include "ContactSelector.h"
+#include "Simulation.h"
+#include "util.h"
+
+namespace {
+
+constexpr int32_t never_recovered = std::numeric_limits<int32_t>::min() / 2;
+
+} // namespace
+
+DayStepSimulation::DayStepSimulation(config& conf, const Model& model, int threads)
+    : cfg(conf), model_(model), pool_(threads) {
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+void DayStepSimulation::start() {
+    const int days = (int) std::max(0.0, std::floor(cfg.t_max));
+    recovered_on_.assign((size_t) cfg.N, never_recovered);
+    infected_.assign((size_t) cfg.N, 0);
+    susceptibility_by_tau_.resize((size_t) days + 2);
+    for (int tau = 0; tau <= days; tau++) {
+        susceptibility_by_tau_[tau] = model_.susceptibility(tau);
+    }
+    susceptibility_by_tau_[days + 1] = cfg.susc_initial;
+    infection_by_tau_.resize(susceptibility_by_tau_.size());
+    totals_.resize((size_t) (cfg.N + block_size - 1) / block_size);
+    cases_by_day_.assign((size_t) days + 1, 0);
+    trajectory_.clear();
+
+    // Initial infections are chosen like Simulation::start() chooses them
+    epi::BlockRng rng(cfg.seed, cfg.stream);
+    rng.set_antithetic(cfg.antithetic);
+    epi::RngScope scope(rng);
+    for (int i : Contagion::initial_infections(cfg, ContactSelector(cfg.N))) {
+        infected_[i] = 1;
+    }
+}
+
+void DayStepSimulation::simulate() {
+    this->start();
+    const int days = (int) cases_by_day_.size() - 1;
+    int64_t infected = std::count(infected_.begin(), infected_.end(), 1);
+    for (int day = 0; day < days; day++) {
+        const double force = cfg.N > 0 ? cfg.beta * (double) infected / cfg.N : 0;
+        for (size_t i = 0; i < infection_by_tau_.size(); i++) {
+            infection_by_tau_[i] = 1 - epi::math::exp(-force * susceptibility_by_tau_[i]);
+        }
+        pool_.parallel_for((int) totals_.size(), [&](int block) {
+            totals_[block] = this->step_block(day, block);
+        });
+
+        // Block order, not completion order, so the sums do not depend on the threads
+        BlockTotals total;
+        for (const BlockTotals& block : totals_) {
+            total.cases += block.cases;
+            total.infected += block.infected;
+            total.susceptibility += block.susceptibility;
+        }
+        infected = total.infected;
+        cases_by_day_[day] = (int) total.cases;
+        DayStats row = {day, (int) total.cases, (int) total.infected,
+                        cfg.N > 0 ? total.susceptibility / cfg.N : 0};
+        trajectory_.push_back(row);
+        if (!cfg.quiet) {
+            Simulation::write_row(std::cout, row);
+        }
+        if (this->output.is_open()) {
+            Simulation::write_row(this->output, row);
+        }
+    }
+}
+
+DayStepSimulation::BlockTotals DayStepSimulation::step_block(int day, int block) {
+    const int begin = block * block_size;
+    const int n = std::min(cfg.N - begin, block_size);
+    thread_local std::vector<double> u;
+    u.resize((size_t) n);
+    epi::BlockRng rng(cfg.seed, epi::substream(epi::substream(cfg.stream, (uint64_t) day + 1), (uint64_t) block));
+    rng.set_antithetic(cfg.antithetic);
+    rng.uniforms(u.data(), (size_t) n);
+
+    const double recovery = cfg.inf_length > 0 ? 1 / cfg.inf_length : 1;
+    const int32_t last = (int32_t) susceptibility_by_tau_.size() - 1;
+    const double *s = susceptibility_by_tau_.data();
+    const double *p = infection_by_tau_.data();
+    int32_t *recovered_on = recovered_on_.data() + begin;
+    uint8_t *infected = infected_.data() + begin;
+
+    int64_t cases = 0, infected_count = 0;
+    double susceptibility = 0;
+    for (int i = 0; i < n; i++) {
+        // never_recovered lands on the last entry, susc_initial
+        const int32_t tau = std::min(day - recovered_on[i], last);
+        const bool was_infected = infected[i];
+        const bool infect = u[i] < p[tau];
+        const bool recover = u[i] < recovery;
+        const bool now_infected = was_infected ? !recover : infect;
+        recovered_on[i] = was_infected && recover ? day : recovered_on[i];
+        infected[i] = now_infected;
+        cases += !was_infected & infect;
+        infected_count += now_infected;
+        susceptibility += s[tau];
+    }
+    return {cases, infected_count, susceptibility};
+}
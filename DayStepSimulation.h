@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "ThreadPool.h"
+
+/// The discrete-time formulation of simul_to_send_2.py (`one_run()`): everyone meets everyone, and each day every
+/// susceptible node is infected with probability 1 - exp(-beta * s(tau) * n_I / N), where n_I is the number
+/// infected at the start of the day and s(tau) the model's susceptibility `tau` days after the node's last
+/// recovery (cfg.susc_initial before its first infection), while every infected node recovers with probability
+/// 1 / inf_length. All nodes update synchronously from the state at the start of the day.
+///
+/// Node state is two flat arrays (recovery day, infected flag), updated block by block on a thread pool by a
+/// branch-free loop over tables of s and of the infection probability by tau, which are recomputed once per day.
+/// Each block draws one uniform per node from its own (day, block) substream, so the output does not depend on
+/// the number of threads. Rows are those of Simulation: cases of the day, infected at its end and the mean
+/// susceptibility over it. Spontaneous infections (sp_lambda) are not part of this model.
+class DayStepSimulation {
+public:
+    static constexpr int block_size = 1 << 16;
+
+    DayStepSimulation(config& cfg, const Model& model, int threads);
+
+    /// Runs days 0 .. floor(t_max) - 1.
+    void simulate();
+
+    [[nodiscard]] const std::vector<DayStats>& get_trajectory() const { return trajectory_; }
+    [[nodiscard]] const std::vector<int>& get_cases_by_day() const { return cases_by_day_; }
+
+private:
+    struct BlockTotals {
+        int64_t cases = 0;
+        int64_t infected = 0;
+        double susceptibility = 0;
+    };
+
+    void start();
+    BlockTotals step_block(int day, int block);
+
+    config& cfg;
+    std::ofstream output;
+    Model model_;
+    epi::ThreadPool pool_;
+
+    std::vector<int32_t> recovered_on_; // day of the last recovery, never_recovered before the first
+    std::vector<uint8_t> infected_;
+    std::vector<double> susceptibility_by_tau_; // s(0 .. days), then susc_initial for nodes never infected
+    std::vector<double> infection_by_tau_;      // today's infection probability, same indices
+    std::vector<BlockTotals> totals_;
+    std::vector<int> cases_by_day_;
+    std::vector<DayStats> trajectory_;
+};
@@ -0,0 +1,137 @@
+#include "DistributedSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+#include "Contagion.h"
+#include "Simulation.h"
+#include "util.h"
+
+DistributedSimulation::DistributedSimulation(config& conf, const Model& model,
+                                             std::shared_ptr<const epi::Kernel> kernel, MPI_Comm comm,
+                                             double lookahead_mass)
+    : cfg(conf),
+      model_(model),
+      kernel_(std::move(kernel)),
+      comm_(comm),
+      rank_(epi::MpiSession::rank(comm)),
+      ranks_(epi::MpiSession::size(comm)),
+      lookahead_(std::max(kernel_->min_delay(lookahead_mass), ParallelSimulation::min_lookahead)),
+      map_{conf.N, ranks_} {
+    partition_ = std::make_unique<Partition>(conf, model_, kernel_, map_, rank_, lookahead_);
+    MPI_Type_contiguous((int) sizeof(event), MPI_BYTE, &event_type_);
+    MPI_Type_commit(&event_type_);
+    send_counts_.resize(ranks_);
+    send_offsets_.resize(ranks_);
+    receive_counts_.resize(ranks_);
+    receive_offsets_.resize(ranks_);
+    if (rank_ == 0 && !conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+DistributedSimulation::~DistributedSimulation() {
+    MPI_Type_free(&event_type_);
+}
+
+// As ParallelSimulation::start(), each rank keeping the events of its own nodes
+void DistributedSimulation::start() {
+    partition_->seed(cfg.seed, epi::substream(cfg.stream, rank_ + 1));
+
+    for (const event& e : Contagion::start_events(cfg)) {
+        if (map_.owner(e.node_index) == rank_) {
+            partition_->push(e);
+        }
+    }
+}
+
+double DistributedSimulation::window_after(double time) const {
+    return std::min({time + lookahead_, (double) next_day_, cfg.t_max});
+}
+
+void DistributedSimulation::simulate() {
+    this->start();
+    double window_end = this->window_after(0);
+    windows_ = 0;
+    long exchanged = 0;
+    for (;;) {
+        const bool last = window_end >= cfg.t_max;
+        partition_->run(window_end, last);
+        this->exchange();
+        exchanged += (long) sent_.size();
+        windows_++;
+        if (window_end == next_day_) {
+            this->close_day();
+        }
+        if (last) {
+            break;
+        }
+        window_end = this->window_after(window_end);
+    }
+
+    long local[2] = {partition_->events_processed(), exchanged};
+    long total[2] = {0, 0};
+    MPI_Allreduce(local, total, 2, MPI_LONG, MPI_SUM, comm_);
+    events_processed_ = total[0];
+    events_exchanged_ = total[1];
+}
+
+// Sends every outbox to its rank and queues what the others sent here, all of which falls after the window
+void DistributedSimulation::exchange() {
+    sent_.clear();
+    for (int q = 0; q < ranks_; q++) {
+        std::vector<event>& outbox = partition_->outbox(q);
+        send_offsets_[q] = (int) sent_.size();
+        send_counts_[q] = (int) outbox.size();
+        sent_.insert(sent_.end(), outbox.begin(), outbox.end());
+        outbox.clear();
+    }
+    MPI_Alltoall(send_counts_.data(), 1, MPI_INT, receive_counts_.data(), 1, MPI_INT, comm_);
+    int received = 0;
+    for (int q = 0; q < ranks_; q++) {
+        receive_offsets_[q] = received;
+        received += receive_counts_[q];
+    }
+    received_.resize((size_t) received);
+    MPI_Alltoallv(sent_.data(), send_counts_.data(), send_offsets_.data(), event_type_, received_.data(),
+                  receive_counts_.data(), receive_offsets_.data(), event_type_, comm_);
+    for (const event& e : received_) {
+        partition_->push(e);
+    }
+}
+
+void DistributedSimulation::close_day() {
+    const int day = next_day_++;
+    const Partition::Tally tally = partition_->tally(day);
+    const std::vector<int>& part_cases = partition_->cases_by_day();
+    int local[2] = {day - 1 < (int) part_cases.size() ? part_cases[day - 1] : 0, tally.infected};
+    int total[2] = {0, 0};
+    MPI_Reduce(local, total, 2, MPI_INT, MPI_SUM, 0, comm_);
+
+    // The block sums of all ranks in node order, added up as Simulation::day_stats does
+    std::vector<int> counts(ranks_), offsets(ranks_);
+    int blocks = 0;
+    for (int q = 0; q < ranks_; q++) {
+        offsets[q] = blocks;
+        counts[q] = (map_.end(q) - map_.begin(q) + PartitionMap::granule - 1) / PartitionMap::granule;
+        blocks += counts[q];
+    }
+    std::vector<double> block_sums(rank_ == 0 ? (size_t) blocks : 0);
+    MPI_Gatherv(tally.susceptibility.data(), (int) tally.susceptibility.size(), MPI_DOUBLE, block_sums.data(),
+                counts.data(), offsets.data(), MPI_DOUBLE, 0, comm_);
+    if (rank_ != 0) {
+        return;
+    }
+    double susceptibility = 0;
+    for (double block : block_sums) {
+        susceptibility += block;
+    }
+    DayStats row = {day - 1, total[0], total[1], cfg.N > 0 ? susceptibility / cfg.N : 0};
+    trajectory_.push_back(row);
+    if (!cfg.quiet) {
+        Simulation::write_row(std::cout, row);
+    }
+    if (this->output.is_open()) {
+        Simulation::write_row(this->output, row);
+    }
+}
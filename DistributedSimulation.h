@@ -0,0 +1,95 @@
+#pragma once
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <mpi.h>
+#include "Common.h"
+#include "Kernel.h"
+#include "ParallelSimulation.h"
+#include "Partition.h"
+
+namespace epi {
+
+/// MPI_Init / MPI_Finalize for the lifetime of main().
+class MpiSession {
+public:
+    MpiSession(int& argc, char**& argv) { MPI_Init(&argc, &argv); }
+    ~MpiSession() { MPI_Finalize(); }
+
+    MpiSession(const MpiSession&) = delete;
+    MpiSession& operator=(const MpiSession&) = delete;
+
+    [[nodiscard]] static int rank(MPI_Comm comm = MPI_COMM_WORLD) {
+        int rank = 0;
+        MPI_Comm_rank(comm, &rank);
+        return rank;
+    }
+
+    [[nodiscard]] static int size(MPI_Comm comm = MPI_COMM_WORLD) {
+        int size = 1;
+        MPI_Comm_size(comm, &size);
+        return size;
+    }
+};
+
+} // namespace epi
+
+/// One run across the ranks of an MPI communicator, for populations beyond one machine: rank r holds only
+/// Partition r of the nodes and the ranks advance in the lookahead windows of ParallelSimulation. After each
+/// window the infections a rank caused in other ranks' nodes, batched per destination in the partition's
+/// outboxes, are exchanged in one MPI_Alltoallv. At each day boundary the ranks' tallies are reduced to rank 0,
+/// which alone writes the rows, in the format of Simulation. A run gives the rows of ParallelSimulation with the
+/// same seed and stream, whatever the number of ranks. Every rank must construct and run it with the same config.
+class DistributedSimulation {
+public:
+    DistributedSimulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                          MPI_Comm comm = MPI_COMM_WORLD,
+                          double lookahead_mass = ParallelSimulation::default_lookahead_mass);
+    ~DistributedSimulation();
+
+    DistributedSimulation(const DistributedSimulation&) = delete;
+    DistributedSimulation& operator=(const DistributedSimulation&) = delete;
+
+    /// Runs from time 0 to t_max; collective over the communicator.
+    void simulate();
+
+    [[nodiscard]] int rank() const { return rank_; }
+    [[nodiscard]] int ranks() const { return ranks_; }
+    [[nodiscard]] double lookahead() const { return lookahead_; }
+
+    /// The rows, on rank 0 (empty elsewhere).
+    [[nodiscard]] const std::vector<DayStats>& get_trajectory() const { return trajectory_; }
+
+    /// Totals over all ranks of the last run.
+    [[nodiscard]] long events_processed() const { return events_processed_; }
+    [[nodiscard]] long events_exchanged() const { return events_exchanged_; }
+    [[nodiscard]] long windows() const { return windows_; }
+
+private:
+    void start();
+    void exchange();
+    void close_day();
+    [[nodiscard]] double window_after(double time) const;
+
+    config& cfg;
+    std::ofstream output;
+    Model model_;
+    std::shared_ptr<const epi::Kernel> kernel_;
+    MPI_Comm comm_;
+    int rank_;
+    int ranks_;
+    double lookahead_;
+    PartitionMap map_;
+    std::unique_ptr<Partition> partition_;
+    MPI_Datatype event_type_ = MPI_DATATYPE_NULL;
+
+    // Exchange buffers, reused across windows
+    std::vector<event> sent_, received_;
+    std::vector<int> send_counts_, send_offsets_, receive_counts_, receive_offsets_;
+
+    std::vector<DayStats> trajectory_;
+    int next_day_ = 1;
+    long windows_ = 0;
+    long events_processed_ = 0;
+    long events_exchanged_ = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "sampling.h"
+
+namespace epi {
+
+/// The contact-time kernel of a model: the infectivity profile with everything precomputed from it
+/// (integral and maximum over the infection length, the direct sampler, the contact-time cache).
+/// Immutable once built, so one instance is shared by every simulation of the same profile and
+/// infection length, whatever their beta, seed or thread.
+class Kernel {
+public:
+    Kernel(const InfectivityProfile& profile, double inf_length, double cache_quantum, int cache_entries);
+
+    [[nodiscard]] double inf_length() const { return inf_length_; }
+    [[nodiscard]] double integral() const { return integral_; }
+    [[nodiscard]] double max_value() const { return max_value_; }
+
+    /// Largest delay tau such that contacts earlier than tau after infection carry at most the fraction `mass` of
+    /// the profile's weight over the infection length: the lookahead of parallel engines, which may delay those few
+    /// contacts to tau when they cross partitions.
+    [[nodiscard]] double min_delay(double mass) const;
+
+    /// Times after infection at which an infected node with recovery length `inf_length` makes contacts,
+    /// for contact rate multiplier `beta`.
+    [[nodiscard]] std::vector<double> inf_times(double beta, double inf_length) const;
+
+private:
+    std::function<double(double)> infectivity_;
+    std::function<double()> sampler_; // set for profiles with a direct tau sampler
+    double sampler_integral_;
+    double inf_length_;
+    double integral_ = 0;
+    double max_value_ = 0;
+    std::unique_ptr<const ContactTimeCache> contact_cache_; // for random recovery lengths
+};
+
+} // namespace epi
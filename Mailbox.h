@@ -0,0 +1,154 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace epi {
+
+/// Lock-free multi-producer single-consumer mailboxes between `parties` threads, one mailbox per party.
+/// A producer writes messages into a block per destination (a bump buffer in a 4 KiB, cache-line aligned block)
+/// and posts the block to the destination's mailbox only when it is full or flushed, with a single
+/// compare-and-swap, so the shared cache lines are touched once per block rather than once per message.
+/// The consumer takes its whole mailbox with one exchange and hands each block back to its producer's free list,
+/// again lock-free; blocks are reused, so a steady exchange allocates nothing. Messages from one producer are
+/// delivered in the order they were sent.
+template <class T>
+class Mailboxes {
+    static_assert(std::is_trivially_copyable_v<T>, "messages are copied into raw blocks");
+
+public:
+    static constexpr size_t block_bytes = 4096;
+
+    explicit Mailboxes(int parties) : parties_((size_t) std::max(1, parties)) {}
+
+    Mailboxes(const Mailboxes&) = delete;
+    Mailboxes& operator=(const Mailboxes&) = delete;
+
+    [[nodiscard]] int parties() const { return (int) parties_.size(); }
+
+    /// Sending side of party `self`; use from that party's thread only.
+    class Sender {
+    public:
+        Sender(Mailboxes& mail, int self) : mail_(mail), self_(self), open_(mail.parties_.size(), nullptr) {}
+
+        Sender(const Sender&) = delete;
+        Sender& operator=(const Sender&) = delete;
+
+        ~Sender() { flush(); }
+
+        void send(int destination, const T& message) {
+            Block*& block = open_[destination];
+            if (block == nullptr) {
+                block = mail_.acquire(self_);
+            }
+            block->items[block->count++] = message;
+            if (block->count == Block::capacity) {
+                mail_.post(destination, block);
+                block = nullptr;
+            }
+        }
+
+        /// Posts every partly filled block.
+        void flush() {
+            for (size_t destination = 0; destination < open_.size(); destination++) {
+                if (open_[destination] != nullptr) {
+                    mail_.post((int) destination, open_[destination]);
+                    open_[destination] = nullptr;
+                }
+            }
+        }
+
+    private:
+        Mailboxes& mail_;
+        int self_;
+        std::vector<typename Mailboxes::Block*> open_; // by destination
+    };
+
+    /// Calls f(message) for everything posted to party `self` so far; use from that party's thread only.
+    /// Returns the number of messages.
+    template <class F>
+    size_t receive(int self, F&& f) {
+        Block* list = parties_[self].inbox.exchange(nullptr, std::memory_order_acquire);
+        Block* ordered = nullptr; // the mailbox is a stack: reverse it into posting order
+        while (list != nullptr) {
+            Block* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+        }
+        size_t received = 0;
+        while (ordered != nullptr) {
+            Block* next = ordered->next;
+            for (int i = 0; i < ordered->count; i++) {
+                f(ordered->items[i]);
+            }
+            received += (size_t) ordered->count;
+            ordered->count = 0;
+            push(parties_[ordered->owner].returned, ordered);
+            ordered = next;
+        }
+        return received;
+    }
+
+    /// Blocks allocated so far by all parties (they are never freed before the mailboxes are).
+    [[nodiscard]] size_t blocks_allocated() const {
+        size_t total = 0;
+        for (const Party& party : parties_) {
+            total += party.allocated.size();
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Block {
+        static constexpr int capacity = (int) ((block_bytes - 64) / sizeof(T));
+
+        Block* next = nullptr;
+        int owner = 0;
+        int count = 0;
+        alignas(64) T items[capacity];
+    };
+
+    struct alignas(64) Party {
+        std::atomic<Block*> inbox{nullptr};      // posted to this party
+        alignas(64) std::atomic<Block*> returned{nullptr}; // consumed blocks this party allocated
+        alignas(64) std::vector<Block*> free;    // owned by this party's sender
+        std::vector<std::unique_ptr<Block>> allocated;
+    };
+
+    static void push(std::atomic<Block*>& stack, Block* block) {
+        block->next = stack.load(std::memory_order_relaxed);
+        while (!stack.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    void post(int destination, Block* block) { push(parties_[destination].inbox, block); }
+
+    Block* acquire(int self) {
+        Party& party = parties_[self];
+        if (party.free.empty()) {
+            // Only consumers push and only we take, all at once, so there is no ABA problem
+            for (Block* block = party.returned.exchange(nullptr, std::memory_order_acquire); block != nullptr;) {
+                Block* next = block->next;
+                party.free.push_back(block);
+                block = next;
+            }
+        }
+        if (party.free.empty()) {
+            party.allocated.push_back(std::make_unique<Block>());
+            party.allocated.back()->owner = self;
+            return party.allocated.back().get();
+        }
+        Block* block = party.free.back();
+        party.free.pop_back();
+        return block;
+    }
+
+    std::vector<Party> parties_;
+};
+
+} // namespace epi
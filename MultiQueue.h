@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace epi {
+
+/// Relaxed concurrent priority queue (MultiQueue, Rihani, Sanders & Dementiev 2015): `heaps` sequential min-heaps
+/// on `time`, each behind its own try-lock. An insertion goes to a random heap; a deletion looks at the tops of
+/// two random heaps and pops the smaller. Elements therefore come out only roughly in order: the rank of the
+/// popped element among all queued ones is O(heaps) on average, in exchange for threads almost never waiting on
+/// each other. Use with c x threads heaps (c = 2 to 4). Each thread accesses the queue through its own Handle.
+template <class T>
+class MultiQueue {
+public:
+    explicit MultiQueue(int heaps) : heaps_((size_t) std::max(2, heaps)) {}
+
+    MultiQueue(const MultiQueue&) = delete;
+    MultiQueue& operator=(const MultiQueue&) = delete;
+
+    [[nodiscard]] int heaps() const { return (int) heaps_.size(); }
+
+    /// One thread's access to the queue, with its own generator for the random choices.
+    class Handle {
+    public:
+        Handle(MultiQueue& queue, uint64_t seed) : queue_(queue), state_(seed | 1) {}
+
+        void push(const T& x) {
+            for (;;) {
+                Heap& heap = queue_.heaps_[next() % queue_.heaps_.size()];
+                if (heap.try_lock()) {
+                    heap.items.push_back(x);
+                    std::push_heap(heap.items.begin(), heap.items.end(), std::greater<>());
+                    heap.publish_top();
+                    heap.unlock();
+                    return;
+                }
+            }
+        }
+
+        /// Pops a roughly smallest element; false when every heap is empty.
+        bool try_pop(T& out) {
+            const size_t n = queue_.heaps_.size();
+            for (int attempt = 0; attempt < 8; attempt++) {
+                size_t i = next() % n, j = next() % n;
+                Heap& a = queue_.heaps_[i];
+                Heap& b = queue_.heaps_[j];
+                Heap& heap = b.top.load(std::memory_order_relaxed) < a.top.load(std::memory_order_relaxed) ? b : a;
+                if (heap.top.load(std::memory_order_relaxed) == empty_top) {
+                    continue;
+                }
+                if (heap.try_lock()) {
+                    bool popped = heap.pop(out);
+                    heap.unlock();
+                    if (popped) {
+                        return true;
+                    }
+                }
+            }
+            // Random probes keep missing: look at every heap before reporting empty
+            for (size_t k = 0, start = next() % n; k < n; k++) {
+                Heap& heap = queue_.heaps_[(start + k) % n];
+                if (heap.top.load(std::memory_order_relaxed) == empty_top) {
+                    continue;
+                }
+                heap.lock();
+                bool popped = heap.pop(out);
+                heap.unlock();
+                if (popped) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        uint64_t next() { // xorshift64*
+            state_ ^= state_ >> 12;
+            state_ ^= state_ << 25;
+            state_ ^= state_ >> 27;
+            return state_ * 0x2545F4914F6CDD1DULL;
+        }
+
+        MultiQueue& queue_;
+        uint64_t state_;
+    };
+
+    /// Queued elements that come before `x`: the rank error of popping x. Locks every heap in turn, so it is a
+    /// measurement tool, not for the hot path.
+    size_t count_before(const T& x) {
+        size_t result = 0;
+        for (Heap& heap : heaps_) {
+            heap.lock();
+            for (const T& y : heap.items) {
+                result += x > y;
+            }
+            heap.unlock();
+        }
+        return result;
+    }
+
+private:
+    static constexpr double empty_top = std::numeric_limits<double>::infinity();
+
+    struct alignas(64) Heap {
+        std::atomic<bool> locked{false};
+        std::atomic<double> top{empty_top}; // time of the smallest element, read without the lock
+        std::vector<T> items;
+
+        bool try_lock() {
+            return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+        }
+        void lock() {
+            while (!try_lock()) {
+                std::this_thread::yield();
+            }
+        }
+        void unlock() { locked.store(false, std::memory_order_release); }
+
+        void publish_top() {
+            top.store(items.empty() ? empty_top : items.front().time, std::memory_order_relaxed);
+        }
+
+        bool pop(T& out) {
+            if (items.empty()) {
+                return false;
+            }
+            std::pop_heap(items.begin(), items.end(), std::greater<>());
+            out = items.back();
+            items.pop_back();
+            publish_top();
+            return true;
+        }
+    };
+
+    std::vector<Heap> heaps_;
+};
+
+} // namespace epi
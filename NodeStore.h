@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Common.h"
+
+/// Node records in fixed-size blocks that copies of the store share copy-on-write. Copying a store (a snapshot)
+/// copies one pointer per block; afterwards the first write to a block through either copy clones that block,
+/// so each copy pays only for the blocks it changes. Reads never copy. A block is written in place only while no
+/// other store holds it, which copying does not change on the source, so any number of threads may copy one
+/// store they do not write (e.g. a snapshot) at once.
+class NodeStore {
+public:
+    static constexpr int block_bits = 12;
+    static constexpr int block_size = 1 << block_bits;
+
+    NodeStore() = default;
+
+    /// The copy shares every block with `other`; both clone a block before their next write to it.
+    NodeStore(const NodeStore& other) = default;
+    NodeStore& operator=(const NodeStore& other) = default;
+    NodeStore(NodeStore&&) noexcept = default;
+    NodeStore& operator=(NodeStore&&) noexcept = default;
+
+    /// n records, record i being `init` with index i. Blocks owned by this store alone are refilled in place.
+    void assign(int n, node init) {
+        const size_t blocks = ((size_t) n + block_size - 1) / block_size;
+        blocks_.resize(blocks);
+        for (size_t b = 0; b < blocks; b++) {
+            if (!owned(b)) {
+                blocks_[b] = std::make_shared<Block>();
+            }
+            node *records = blocks_[b]->records;
+            for (int i = 0; i < block_size; i++) {
+                init.index = (int) (b * block_size) + i;
+                records[i] = init;
+            }
+        }
+        size_ = n;
+    }
+
+    [[nodiscard]] int size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    const node& operator[](int i) const {
+        return blocks_[i >> block_bits]->records[i & (block_size - 1)];
+    }
+
+    /// Record i for writing; clones its block first if the block is shared.
+    node& mut(int i) {
+        const size_t b = (size_t) i >> block_bits;
+        if (!owned(b)) {
+            blocks_[b] = std::make_shared<Block>(*blocks_[b]);
+        }
+        return blocks_[b]->records[i & (block_size - 1)];
+    }
+
+    [[nodiscard]] size_t block_count() const { return blocks_.size(); }
+
+    /// Records of block b (block_size of them; those past size() are padding).
+    [[nodiscard]] const node *block(size_t b) const { return blocks_[b]->records; }
+
+    /// Records of block b for writing, cloned first if shared.
+    node *mutable_block(size_t b) {
+        return &mut((int) (b << block_bits));
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        for (size_t b = 0; b < blocks_.size(); b++) {
+            const node *records = blocks_[b]->records;
+            const int n = std::min(block_size, size_ - (int) (b * block_size));
+            for (int i = 0; i < n; i++) {
+                f(records[i]);
+            }
+        }
+    }
+
+    /// Blocks that are not shared with any other store.
+    [[nodiscard]] size_t owned_blocks() const {
+        size_t n = 0;
+        for (size_t b = 0; b < blocks_.size(); b++) n += owned(b);
+        return n;
+    }
+
+private:
+    struct Block {
+        node records[block_size];
+    };
+
+    // Held by this store alone. The count cannot rise meanwhile, as only this store's thread may copy it; the fence
+    // orders our writes after the reads of a store that has just let the block go.
+    [[nodiscard]] bool owned(size_t b) const {
+        if (!blocks_[b] || blocks_[b].use_count() != 1) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    std::vector<std::shared_ptr<Block>> blocks_;
+    int size_ = 0;
+};
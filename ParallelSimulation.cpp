@@ -0,0 +1,147 @@
+#include "ParallelSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include "Contagion.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+ParallelSimulation::ParallelSimulation(config& conf, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                                       int threads, double lookahead_mass)
+    : cfg(conf),
+      model_(model),
+      kernel_(std::move(kernel)),
+      lookahead_(std::max(kernel_->min_delay(lookahead_mass), min_lookahead)) {
+    const PartitionMap map = {conf.N, std::max(1, std::min(threads, conf.N))};
+    for (int p = 0; p < map.parts; p++) {
+        partitions_.push_back(std::make_unique<Partition>(conf, model_, kernel_, map, p, lookahead_));
+    }
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+ParallelSimulation::~ParallelSimulation() = default;
+
+void ParallelSimulation::start() {
+    const PartitionMap map = {cfg.N, (int) partitions_.size()};
+    for (auto& partition : partitions_) {
+        partition->seed(cfg.seed, epi::substream(cfg.stream, partition->part() + 1));
+    }
+
+    // Spontaneous infections all go through the tourist node of part 0
+    for (const event& e : Contagion::start_events(cfg)) {
+        partitions_[map.owner(e.node_index)]->push(e);
+    }
+}
+
+double ParallelSimulation::window_after(double time) const {
+    return std::min({time + lookahead_, (double) next_day_, cfg.t_max});
+}
+
+void ParallelSimulation::simulate() {
+    this->start();
+    const int parts = (int) partitions_.size();
+    std::vector<Partition::Tally> tallies(parts);
+    double window_end = this->window_after(0);
+    bool done = false;
+    windows_ = 0;
+    epi::Barrier barrier(parts);
+    epi::Mailboxes<event> mail(parts);
+
+    auto work = [&](int p) {
+        Partition& partition = *partitions_[p];
+        epi::Mailboxes<event>::Sender sender(mail, p);
+        partition.connect(&sender);
+        for (;;) {
+            const bool last = window_end >= cfg.t_max;
+            partition.run(window_end, last);
+            sender.flush();
+            barrier.arrive_and_wait();
+            // Every part has finished the window: collect what the others sent here
+            mail.receive(p, [&](const event& e) { partition.push(e); });
+            if (window_end == next_day_) {
+                tallies[p] = partition.tally(next_day_);
+            }
+            barrier.arrive_and_wait([&] {
+                windows_++;
+                if (window_end == next_day_) {
+                    this->close_day(tallies);
+                }
+                if (last) {
+                    done = true;
+                } else {
+                    window_end = this->window_after(window_end);
+                }
+            });
+            if (done) {
+                partition.connect(nullptr);
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int p = 1; p < parts; p++) {
+        workers.emplace_back(work, p);
+    }
+    work(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ParallelSimulation::close_day(const std::vector<Partition::Tally>& tallies) {
+    const int day = next_day_++;
+    int cases = 0, infected = 0;
+    double susceptibility = 0;
+    for (size_t p = 0; p < partitions_.size(); p++) {
+        const std::vector<int>& part_cases = partitions_[p]->cases_by_day();
+        cases += day - 1 < (int) part_cases.size() ? part_cases[day - 1] : 0;
+        infected += tallies[p].infected;
+        for (double block : tallies[p].susceptibility) {
+            susceptibility += block; // block by block as Simulation::day_stats, whatever the partitioning
+        }
+    }
+    DayStats row = {day - 1, cases, infected, cfg.N > 0 ? susceptibility / cfg.N : 0};
+    trajectory_.push_back(row);
+    if (!cfg.quiet) {
+        Simulation::write_row(std::cout, row);
+    }
+    if (this->output.is_open()) {
+        Simulation::write_row(this->output, row);
+    }
+}
+
+std::vector<int> ParallelSimulation::get_cases_by_day() const {
+    std::vector<int> result;
+    for (const auto& partition : partitions_) {
+        const std::vector<int>& part_cases = partition->cases_by_day();
+        if (result.size() < part_cases.size()) {
+            result.resize(part_cases.size(), 0);
+        }
+        for (size_t d = 0; d < part_cases.size(); d++) {
+            result[d] += part_cases[d];
+        }
+    }
+    return result;
+}
+
+long ParallelSimulation::events_processed() const {
+    long total = 0;
+    for (const auto& partition : partitions_) {
+        total += partition->events_processed();
+    }
+    return total;
+}
+
+long ParallelSimulation::delayed_contacts() const {
+    long total = 0;
+    for (const auto& partition : partitions_) {
+        total += partition->delayed_contacts();
+    }
+    return total;
+}
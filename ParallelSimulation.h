@@ -0,0 +1,56 @@
+#pragma once
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "Kernel.h"
+#include "Partition.h"
+
+/// One run on several threads (conservative windowed synchronization). The nodes are split into one Partition
+/// per thread, and the partitions advance together in windows no longer than the lookahead, the delay before
+/// which a contact happens with probability at most `lookahead_mass` (Kernel::min_delay), and never across a
+/// day boundary. After each window the partitions swap the infections they caused in each other's nodes, all
+/// of which fall after the window, so no event ever arrives in a partition's past. The rare contacts earlier than
+/// the lookahead are delayed to it; apart from that the run is distributed like a sequential one. It writes the
+/// same rows as Simulation, but is a different sample. Since every attempt has its own substream and every node
+/// sees its events in the same order, the rows depend on the seed and the stream, not on the number of threads.
+class ParallelSimulation {
+public:
+    static constexpr double default_lookahead_mass = 1e-6;
+    static constexpr double min_lookahead = 1.0 / 1440; // for profiles that do not vanish at 0
+
+    ParallelSimulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel, int threads,
+                       double lookahead_mass = default_lookahead_mass);
+    ~ParallelSimulation();
+
+    ParallelSimulation(const ParallelSimulation&) = delete;
+    ParallelSimulation& operator=(const ParallelSimulation&) = delete;
+
+    /// Runs from time 0 to t_max.
+    void simulate();
+
+    [[nodiscard]] double lookahead() const { return lookahead_; }
+    [[nodiscard]] int partitions() const { return (int) partitions_.size(); }
+
+    [[nodiscard]] const std::vector<DayStats>& get_trajectory() const { return trajectory_; }
+    [[nodiscard]] std::vector<int> get_cases_by_day() const;
+    [[nodiscard]] long events_processed() const;
+    [[nodiscard]] long delayed_contacts() const;
+    /// Synchronization windows of the last run.
+    [[nodiscard]] long windows() const { return windows_; }
+
+private:
+    void start();
+    void close_day(const std::vector<Partition::Tally>& tallies);
+    [[nodiscard]] double window_after(double time) const;
+
+    config& cfg;
+    std::ofstream output;
+    Model model_;
+    std::shared_ptr<const epi::Kernel> kernel_;
+    double lookahead_;
+    std::vector<std::unique_ptr<Partition>> partitions_;
+    std::vector<DayStats> trajectory_;
+    int next_day_ = 1;
+    long windows_ = 0;
+};
@@ -0,0 +1,92 @@
+#include "Partition.h"
+#include <cmath>
+#include <limits>
+#include <utility>
+
+Partition::Partition(const config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                     PartitionMap map, int part, double lookahead)
+    : cfg_(cfg),
+      map_(map),
+      part_(part),
+      begin_(map.begin(part)),
+      lookahead_(lookahead),
+      nodes_((size_t) (map.end(part) - map.begin(part)), {0, 0, 0.0, cfg.susc_initial, 0.0, 0, false}),
+      outboxes_((size_t) map.parts),
+      cases_by_day_((size_t) std::max(0.0, std::floor(cfg.t_max)) + 1, 0),
+      contagion_(cfg, model, std::move(kernel)) {
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        nodes_[i].index = begin_ + (int) i;
+    }
+}
+
+void Partition::seed(uint64_t seed, uint64_t stream) {
+    rng_ = epi::BlockRng(seed, stream);
+    rng_.set_antithetic(cfg_.antithetic);
+}
+
+double Partition::next_time() const {
+    return queue_.empty() ? std::numeric_limits<double>::infinity() : queue_.front().time;
+}
+
+void Partition::run(double end, bool inclusive) {
+    epi::RngScope scope(rng_);
+    while (!queue_.empty()) {
+        const double t = queue_.front().time;
+        if (t > end || (t == end && !inclusive)) {
+            break;
+        }
+        event e = pop();
+        events_processed_++;
+        if (!queue_.empty() && queue_.front().node_index >= 0) {
+            ContactSelector::prefetch(nodes_, queue_.front().node_index - begin_);
+        }
+        switch (e.action) {
+            case Infection:
+                infect(e);
+                break;
+            case Recovery:
+                nodes_[e.node_index - begin_].infected = false;
+                break;
+        }
+    }
+}
+
+// Contacts are routed to the part owning them
+void Partition::infect(const event& e) {
+    node& target = e.node_index >= 0 ? nodes_[e.node_index - begin_] : tourist_node_;
+    const Contagion::Attempt attempt = contagion_.attempt(target, e.node_index, e.time);
+    if (!attempt.infected) {
+        return;
+    }
+    if (e.node_index >= 0) {
+        push({target.last_recovery_time, target.index, Recovery});
+    }
+
+    const auto day = (size_t) e.time;
+    if (day >= cases_by_day_.size()) {
+        cases_by_day_.resize(day + 1, 0);
+    }
+    cases_by_day_[day]++;
+
+    contagion_.spread(attempt, e.time);
+    const std::vector<double>& delays = contagion_.delays();
+    const std::vector<int>& contacts = contagion_.contacts();
+    for (size_t i = 0; i < delays.size(); i++) {
+        double time = e.time + delays[i];
+        if (delays[i] < lookahead_) {
+            time = e.time + lookahead_;
+            delayed_contacts_++;
+            if (time > cfg_.t_max) {
+                continue;
+            }
+        }
+        const int owner = map_.owner(contacts[i]);
+        if (owner == part_) {
+            push({time, contacts[i], Infection});
+        } else if (sender_ != nullptr) {
+            sender_->send(owner, {time, contacts[i], Infection});
+        } else {
+            outboxes_[owner].push_back({time, contacts[i], Infection});
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include "Common.h"
+#include "Contagion.h"
+#include "ContactSelector.h"
+#include "Kernel.h"
+#include "Mailbox.h"
+#include "NodeStore.h"
+#include "util.h"
+
+/// Assignment of the nodes 0..population-1 to `parts` contiguous ranges of (nearly) equal size, made of whole
+/// NodeStore blocks so that every part tallies the same blocks as Simulation::day_stats. The tourist node
+/// (index -1) belongs to part 0.
+struct PartitionMap {
+    static constexpr int granule = NodeStore::block_size;
+
+    int population;
+    int parts;
+
+    [[nodiscard]] int chunk() const {
+        const int blocks = (population + granule - 1) / granule;
+        return std::max(1, (blocks + parts - 1) / parts) * granule;
+    }
+    [[nodiscard]] int owner(int index) const { return index < 0 ? 0 : index / chunk(); }
+    [[nodiscard]] int begin(int part) const { return std::min(population, part * chunk()); }
+    [[nodiscard]] int end(int part) const { return std::min(population, (part + 1) * chunk()); }
+};
+
+/// The nodes of one part of a partitioned run, with their own event queue. Every infection attempt draws from
+/// its own substream, as in --crn mode, and every contact falls at least `lookahead` after the infection causing
+/// it (earlier ones are delayed to it), so no event caused in a window no longer than the lookahead falls in that
+/// window: a part can run to the end of it without hearing from the others, and the nodes evolve the same
+/// whichever part owns them. Infections of nodes owned by another part go to that part's outbox. Parts share only
+/// the immutable kernel and model; the engine driving them moves the outboxes.
+class Partition {
+public:
+    Partition(const config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel, PartitionMap map,
+              int part, double lookahead);
+
+    [[nodiscard]] int part() const { return part_; }
+    [[nodiscard]] int begin() const { return begin_; }
+    [[nodiscard]] int end() const { return begin_ + (int) nodes_.size(); }
+
+    /// Restarts the part's generator on stream `stream` of `seed`. It only hosts the per-attempt substreams.
+    void seed(uint64_t seed, uint64_t stream);
+
+    /// Queues an event of a node this part owns.
+    void push(const event& e) {
+        queue_.push_back(e);
+        std::push_heap(queue_.begin(), queue_.end(), Later());
+    }
+
+    /// Queues the events another part sent here.
+    void receive(const std::vector<event>& events) {
+        for (const event& e : events) {
+            push(e);
+        }
+    }
+
+    /// Processes every queued event before `end`, and at `end` too if `inclusive`.
+    void run(double end, bool inclusive);
+
+    /// Events for the nodes of part `part` caused since the outbox was last cleared.
+    std::vector<event>& outbox(int part) { return outboxes_[part]; }
+
+    /// Sends events for other parts through `sender` (from the thread running this part) instead of the
+    /// outboxes; nullptr goes back to the outboxes.
+    void connect(epi::Mailboxes<event>::Sender* sender) { sender_ = sender; }
+
+    /// Time of the earliest queued event (+inf when there is none).
+    [[nodiscard]] double next_time() const;
+
+    /// This part's share of the statistics row of day `day` - 1 (see Simulation::day_stats).
+    using Tally = Contagion::Tally;
+    [[nodiscard]] Tally tally(int day) const { return contagion_.tally(nodes_.data(), nodes_.size(), day); }
+
+    /// New cases among this part's nodes (and the tourist's, in part 0) by day.
+    [[nodiscard]] const std::vector<int>& cases_by_day() const { return cases_by_day_; }
+
+    [[nodiscard]] long events_processed() const { return events_processed_; }
+
+    /// Contacts made earlier than the lookahead and delayed to it.
+    [[nodiscard]] long delayed_contacts() const { return delayed_contacts_; }
+
+private:
+    /// Queue order: by time, ties by node and action, so a node sees its events in the same order in every part.
+    struct Later {
+        bool operator()(const event& a, const event& b) const {
+            return std::tie(a.time, a.node_index, a.action) > std::tie(b.time, b.node_index, b.action);
+        }
+    };
+
+    void infect(const event& e);
+
+    event pop() {
+        std::pop_heap(queue_.begin(), queue_.end(), Later());
+        event e = queue_.back();
+        queue_.pop_back();
+        return e;
+    }
+
+    const config& cfg_;
+    PartitionMap map_;
+    int part_;
+    int begin_;
+    double lookahead_;
+
+    std::vector<node> nodes_; // nodes begin_.. of the population
+    node tourist_node_ = {.index = -1, .exposures = 0, .infectivity = 1.0, .susceptibility = 1.0,
+                          .last_recovery_time = 0, .recovery_count = 0, .infected = true};
+    std::vector<event> queue_; // min-heap in Later order
+    std::vector<std::vector<event>> outboxes_;
+    epi::Mailboxes<event>::Sender* sender_ = nullptr;
+    std::vector<int> cases_by_day_;
+    long events_processed_ = 0;
+    long delayed_contacts_ = 0;
+
+    epi::BlockRng rng_;
+    Contagion contagion_;
+};
@@ -0,0 +1,225 @@
+#include "RelaxedSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include "Contagion.h"
+#include "Partition.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+struct RelaxedSimulation::Worker {
+    Worker(epi::MultiQueue<event>& queue, uint64_t seed, const config& cfg, const Model& model,
+           std::shared_ptr<const epi::Kernel> kernel, size_t days)
+        : queue(queue, seed), contagion(cfg, model, std::move(kernel)), later(days) {}
+
+    epi::MultiQueue<event>::Handle queue;
+    Contagion contagion; // its scratch is per thread
+    std::vector<std::vector<event>> later; // events of later windows, by day
+    epi::BlockRng rng;
+    long events_processed = 0;
+    long rank_samples = 0, rank_sum = 0, rank_max = 0;
+    Contagion::Tally tally; // of the nodes of part w of a PartitionMap into one part per thread
+};
+
+RelaxedSimulation::RelaxedSimulation(config& conf, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                                     int threads, int heaps_per_thread)
+    : cfg(conf),
+      model_(model),
+      kernel_(std::move(kernel)),
+      threads_(std::max(1, threads)),
+      heaps_per_thread_(std::max(1, heaps_per_thread)) {
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+RelaxedSimulation::~RelaxedSimulation() = default;
+
+void RelaxedSimulation::lock(int index) {
+    std::atomic<bool>& flag = locks_[index >= 0 ? index : cfg.N];
+    while (flag.load(std::memory_order_relaxed) || flag.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+void RelaxedSimulation::unlock(int index) {
+    locks_[index >= 0 ? index : cfg.N].store(false, std::memory_order_release);
+}
+
+void RelaxedSimulation::start() {
+    nodes_.assign((size_t) cfg.N, {0, 0, 0.0, cfg.susc_initial, 0.0, 0, false});
+    for (int i = 0; i < cfg.N; i++) {
+        nodes_[i].index = i;
+    }
+    locks_ = std::make_unique<std::atomic<bool>[]>((size_t) cfg.N + 1);
+    days_ = (size_t) std::max(0.0, std::floor(cfg.t_max)) + 2; // and one for events at exactly t_max
+    cases_by_day_ = std::make_unique<std::atomic<int>[]>(days_);
+    queue_ = std::make_unique<epi::MultiQueue<event>>(heaps_per_thread_ * threads_);
+    workers_.clear();
+    for (int w = 0; w < threads_; w++) {
+        workers_.push_back(
+            std::make_unique<Worker>(*queue_, epi::substream(cfg.seed, w), cfg, model_, kernel_, days_));
+    }
+
+    for (const event& e : Contagion::start_events(cfg)) {
+        workers_[0]->later[(size_t) e.time].push_back(e);
+    }
+}
+
+void RelaxedSimulation::schedule(Worker& worker, const event& e) {
+    if (e.time > cfg.t_max) {
+        return; // e.g. a recovery after the end, which no engine gets to
+    }
+    if (e.time < window_end_ || (last_window_ && e.time <= window_end_)) {
+        outstanding_.fetch_add(1, std::memory_order_relaxed); // before it can be popped and finished
+        worker.queue.push(e);
+    } else {
+        worker.later[(size_t) e.time].push_back(e);
+    }
+}
+
+void RelaxedSimulation::process(Worker& worker, const event& e) {
+    worker.events_processed++;
+    if (e.action == Infection) {
+        this->infect(worker, e);
+    } else {
+        this->lock(e.node_index);
+        nodes_[e.node_index].infected = false;
+        this->unlock(e.node_index);
+    }
+}
+
+// The node's update under its lock
+void RelaxedSimulation::infect(Worker& worker, const event& e) {
+    node& target = e.node_index >= 0 ? nodes_[e.node_index] : tourist_node_;
+    this->lock(e.node_index);
+    const Contagion::Attempt attempt = worker.contagion.attempt(target, e.node_index, e.time);
+    this->unlock(e.node_index);
+    if (!attempt.infected) {
+        return;
+    }
+
+    if (e.node_index >= 0) {
+        this->schedule(worker, {e.time + attempt.recovery_length, e.node_index, Recovery});
+    }
+    cases_by_day_[std::min((size_t) e.time, days_ - 1)].fetch_add(1, std::memory_order_relaxed);
+
+    worker.contagion.spread(attempt, e.time);
+    const std::vector<double>& delays = worker.contagion.delays();
+    for (size_t i = 0; i < delays.size(); i++) {
+        this->schedule(worker, {e.time + delays[i], worker.contagion.contacts()[i], Infection});
+    }
+}
+
+void RelaxedSimulation::simulate() {
+    this->start();
+    window_end_ = std::min(1.0, cfg.t_max);
+    last_window_ = window_end_ >= cfg.t_max;
+    size_t day = 0;
+    bool done = false;
+    epi::Barrier barrier(threads_);
+
+    auto work = [&](int w) {
+        Worker& worker = *workers_[w];
+        epi::RngScope scope(worker.rng);
+        long pops = 0;
+        for (;;) {
+            // Bring this window's events in from the bucket, then process until no thread has any left
+            for (const event& e : worker.later[day]) {
+                this->schedule(worker, e);
+            }
+            worker.later[day].clear();
+            barrier.arrive_and_wait();
+            event e{};
+            for (;;) {
+                if (worker.queue.try_pop(e)) {
+                    if (rank_sample_every_ > 0 && ++pops % rank_sample_every_ == 0) {
+                        long rank = (long) queue_->count_before(e);
+                        worker.rank_samples++;
+                        worker.rank_sum += rank;
+                        worker.rank_max = std::max(worker.rank_max, rank);
+                    }
+                    this->process(worker, e);
+                    outstanding_.fetch_sub(1, std::memory_order_acq_rel);
+                } else if (outstanding_.load(std::memory_order_acquire) == 0) {
+                    break;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            barrier.arrive_and_wait();
+            const bool closes_day = window_end_ == next_day_;
+            if (closes_day) {
+                const PartitionMap map = {cfg.N, threads_};
+                worker.tally = worker.contagion.tally(nodes_.data() + map.begin(w), map.end(w) - map.begin(w),
+                                                      next_day_);
+            }
+            barrier.arrive_and_wait([&] {
+                if (closes_day) {
+                    int infected = 0;
+                    double susceptibility = 0;
+                    for (const auto& each : workers_) {
+                        infected += each->tally.infected;
+                        for (double block : each->tally.susceptibility) {
+                            susceptibility += block;
+                        }
+                    }
+                    this->close_day(susceptibility, infected);
+                }
+                if (last_window_) {
+                    done = true;
+                } else {
+                    day++;
+                    window_end_ = std::min((double) day + 1, cfg.t_max);
+                    last_window_ = window_end_ >= cfg.t_max;
+                }
+            });
+            if (done) {
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < threads_; w++) {
+        threads.emplace_back(work, w);
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    events_processed_ = 0;
+    rank_error_ = {};
+    long rank_sum = 0;
+    for (const auto& worker : workers_) {
+        events_processed_ += worker->events_processed;
+        rank_error_.samples += worker->rank_samples;
+        rank_sum += worker->rank_sum;
+        rank_error_.max = std::max(rank_error_.max, worker->rank_max);
+    }
+    rank_error_.mean = rank_error_.samples > 0 ? (double) rank_sum / (double) rank_error_.samples : 0;
+}
+
+void RelaxedSimulation::close_day(double susceptibility, int infected) {
+    const int day = next_day_++;
+    DayStats row = {day - 1, cases_by_day_[day - 1].load(), infected, cfg.N > 0 ? susceptibility / cfg.N : 0};
+    trajectory_.push_back(row);
+    if (!cfg.quiet) {
+        Simulation::write_row(std::cout, row);
+    }
+    if (this->output.is_open()) {
+        Simulation::write_row(this->output, row);
+    }
+}
+
+std::vector<int> RelaxedSimulation::get_cases_by_day() const {
+    std::vector<int> result(days_ - 1);
+    for (size_t d = 0; d < result.size(); d++) {
+        result[d] = cases_by_day_[d].load();
+    }
+    return result;
+}
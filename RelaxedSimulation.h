@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "Kernel.h"
+#include "MultiQueue.h"
+
+/// One run on several threads that share a single relaxed event queue (epi::MultiQueue with
+/// `heaps_per_thread` x threads heaps). Every thread pops roughly the earliest event and runs infect() or recover()
+/// on the shared nodes, each node update under that node's spin lock, so events are processed only approximately
+/// in time order: an event may be handled while a few earlier ones are still queued or in progress on other
+/// threads. Events of later days wait in per-thread buckets, so days stay separated: a day's row is taken once
+/// every event of the day is done. Every infection attempt draws from its own substream as in --crn mode.
+/// For exploratory runs only; the output is not reproducible and its deviation from the sequential engine is what
+/// --validate-engine measures (with the rank error of the pops).
+class RelaxedSimulation {
+public:
+    static constexpr int default_heaps_per_thread = 2;
+
+    RelaxedSimulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel, int threads,
+                      int heaps_per_thread = default_heaps_per_thread);
+    ~RelaxedSimulation();
+
+    RelaxedSimulation(const RelaxedSimulation&) = delete;
+    RelaxedSimulation& operator=(const RelaxedSimulation&) = delete;
+
+    /// Runs from time 0 to t_max (once per instance).
+    void simulate();
+
+    /// Measures the rank error of every `every`-th pop (0: off). Each sample scans the whole queue.
+    void sample_rank_error(int every) { rank_sample_every_ = every; }
+
+    [[nodiscard]] const std::vector<DayStats>& get_trajectory() const { return trajectory_; }
+    [[nodiscard]] std::vector<int> get_cases_by_day() const;
+    [[nodiscard]] long events_processed() const { return events_processed_; }
+
+    /// Rank errors measured by the last run: how many queued events came before each sampled pop.
+    struct RankError {
+        long samples = 0;
+        double mean = 0;
+        long max = 0;
+    };
+    [[nodiscard]] RankError rank_error() const { return rank_error_; }
+
+private:
+    struct Worker;
+
+    void start();
+    void process(Worker& worker, const event& e);
+    void infect(Worker& worker, const event& e);
+    void schedule(Worker& worker, const event& e);
+    void close_day(double susceptibility, int infected);
+
+    void lock(int index);
+    void unlock(int index);
+
+    config& cfg;
+    std::ofstream output;
+    Model model_;
+    std::shared_ptr<const epi::Kernel> kernel_;
+    int threads_;
+    int heaps_per_thread_;
+    int rank_sample_every_ = 0;
+
+    std::vector<node> nodes_;
+    std::unique_ptr<std::atomic<bool>[]> locks_; // per node, then the tourist's
+    node tourist_node_ = {.index = -1, .exposures = 0, .infectivity = 1.0, .susceptibility = 1.0,
+                          .last_recovery_time = 0, .recovery_count = 0, .infected = true};
+    std::unique_ptr<std::atomic<int>[]> cases_by_day_;
+    size_t days_ = 0;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::unique_ptr<epi::MultiQueue<event>> queue_;
+    std::atomic<long> outstanding_{0}; // events of the window queued or being processed
+
+    // The current window: events before window_end_ (up to it in the last window) go to the queue
+    double window_end_ = 0;
+    bool last_window_ = false;
+
+    std::vector<DayStats> trajectory_;
+    int next_day_ = 1;
+    long events_processed_ = 0;
+    RankError rank_error_;
+};
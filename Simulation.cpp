@@ -3,33 +3,105 @@
 #include <utility> // For std::move
 #include "Simulation.h"
 #include "Common.h"
+#include "Contagion.h"
 #include "util.h"
 
-node tourist_node {
-    .index = -1,
-    .infectivity = 1.0,
-    .susceptibility = 1.0,
-    .last_recovery_time = 0,
-    .recovery_count = 0,
-    .infected = true
-};
-
 Simulation::Simulation(config &conf,
-                       std::function<double(double)> infectivity_func,
+                       std::shared_ptr<const epi::Kernel> kernel,
                        std::function<double(double)> susc_func,
-                       std::function<double(double)> recovery_func
+                       epi::RecoverySampler recovery_func
                        )
     : cfg(conf),
-      infectivity_func_(std::move(infectivity_func)),
+      kernel_(std::move(kernel)),
       susceptibility_func_(std::move(susc_func)),
-      recovery_func_(std::move(recovery_func)) {
-    for (int i = 0; i < cfg.N; i++) {
-        node n = {i, 0.0, conf.susc_initial, 0.0, 0, false};
-        nodes.push_back(n);
+      contagion_(conf, kernel_, susceptibility_func_, std::move(recovery_func), false) {
+    this->clear_state();
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+void Simulation::clear_state() {
+    this->nodes.assign(cfg.N, {0, 0, 0.0, cfg.susc_initial, 0.0, 0, false});
+    this->Q.clear();
+    this->cases_by_day.assign((size_t) std::max(0.0, std::floor(cfg.t_max)) + 1, 0);
+    this->trajectory_.clear();
+    this->next_day_ = 1;
+    this->events_processed_ = 0;
+    this->time_ = 0;
+    this->tourist_node.exposures = 0;
+}
+
+void Simulation::reset(uint64_t seed, uint64_t stream) {
+    cfg.seed = seed;
+    cfg.stream = stream;
+    this->contagion_.resize();
+    this->clear_state();
+    this->rng_prefix_.clear();
+    // The output of the new run starts afresh, in the same file or another one
+    if (this->output.is_open()) {
+        this->output.close();
+    }
+    if (!cfg.output_file.empty()) {
+        this->output.open(cfg.output_file, std::ios::trunc);
+    }
+}
+
+Simulation::Simulation(config &conf,
+                       const InfectivityProfile& infectivity_profile,
+                       std::function<double(double)> susc_func,
+                       epi::RecoverySampler recovery_func)
+    : Simulation(conf,
+                 std::make_shared<const epi::Kernel>(infectivity_profile, conf.inf_length,
+                                                     conf.contact_cache_quantum, conf.contact_cache_entries),
+                 std::move(susc_func), std::move(recovery_func)) {
+}
+
+Simulation::Simulation(config &conf,
+                       std::function<double(double)> infectivity_func,
+                       std::function<double(double)> susc_func,
+                       epi::RecoverySampler recovery_func)
+    : Simulation(conf, InfectivityProfile{.max_function_value = 0, .infectivity_function = std::move(infectivity_func)},
+                 std::move(susc_func), std::move(recovery_func)) {
+}
+
+Simulation::Simulation(config &conf, const Model& model)
+    : Simulation(conf, model.infectivity, model.susceptibility, model.recovery) {
+}
+
+Simulation::Simulation(config &conf, const Model& model, std::shared_ptr<const epi::Kernel> kernel)
+    : Simulation(conf, std::move(kernel), model.susceptibility, model.recovery) {
+}
+
+Simulation::Simulation(config &conf, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                       const Snapshot& snapshot)
+    // Built from the snapshot directly: the fork shares its node blocks and allocates none of its own
+    : cfg(conf),
+      nodes(snapshot.nodes),
+      Q(snapshot.queue),
+      cases_by_day(snapshot.cases_by_day),
+      trajectory_(snapshot.trajectory),
+      next_day_(snapshot.next_day),
+      events_processed_(snapshot.events_processed),
+      time_(snapshot.time),
+      tourist_node(snapshot.tourist),
+      kernel_(std::move(kernel)),
+      susceptibility_func_(model.susceptibility),
+      contagion_(conf, kernel_, susceptibility_func_, model.recovery, false),
+      rng_(snapshot.rng) {
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+    if (this->output.is_open()) {
+        for (const DayStats& row : this->trajectory_) {
+            write_row(this->output, row);
+        }
     }
-    this->cases_by_day = std::map<int, int>();
-    this->output = std::ofstream(conf.output_file);
-    compute_integral_numerically(conf.inf_length);
+}
+
+Simulation::Snapshot Simulation::snapshot() const {
+    return {this->nodes, this->Q, this->cases_by_day, this->trajectory_, this->next_day_,
+            this->tourist_node, this->events_processed_, this->rng_, this->time_};
 }
 
 Simulation::~Simulation() {
@@ -42,11 +114,23 @@ Simulation::~Simulation() {
 // as they are now handled by the std::function members.
 
 void Simulation::simulate() {
+    this->start();
+    this->run_until(cfg.t_max);
+}
 
-    // Assuming a single initial infected (first in the index)
-    for (int i = 0; i < this->cfg.n_initial; i++) {
+void Simulation::start() {
+    rng_ = epi::BlockRng(cfg.seed, cfg.stream);
+    rng_.set_antithetic(cfg.antithetic);
+    if (!rng_prefix_.empty()) {
+        rng_.set_prefix(rng_prefix_.data(), (int) rng_prefix_.size());
+    }
+    epi::RngScope scope(rng_);
+    tourist_node.exposures = 0;
+
+    // Initial infected nodes are distinct and chosen at random (the first draws of the run)
+    for (int i : Contagion::initial_infections(this->cfg, this->contagion_.contact_selector())) {
         event initial_infection = {0.0, i, Infection};
-        this->Q.push(initial_infection);
+        this->push_event(initial_infection);
     }
 
     // Pushing spontaneous infection events
@@ -57,7 +141,7 @@ void Simulation::simulate() {
     std::vector<double> sp_inf_times = this->get_spontaneous_infection_times(cfg.sp_lambda);
     for (double t : sp_inf_times) {
         event sp_infection = {t, -1, Infection};
-        this->Q.push(sp_infection);
+        this->push_event(sp_infection);
     }
     */
 
@@ -66,14 +150,26 @@ void Simulation::simulate() {
     std::vector<double> sp_inf_times = this->get_deterministic_infection_times(cfg.sp_lambda);
     for (double t : sp_inf_times) {
         event sp_infection = {t, -1, Infection};
-        this->Q.push(sp_infection);
+        this->push_event(sp_infection);
     }
+}
 
+void Simulation::run_until(double t) {
+    epi::RngScope scope(rng_);
     while (!Q.empty()) {
-        event e = Q.top();
-        if (e.time > cfg.t_max) {
+        if (Q.front().time > t) {
             break;
         }
+        event e = this->pop_event();
+        events_processed_++;
+        // Statistics of a completed day are taken before the first event of the next one
+        while (e.time >= next_day_) {
+            this->close_day();
+        }
+        // The next event is probably the new top: start loading its node while this one is processed
+        if (!Q.empty() && Q.front().node_index >= 0) {
+            ContactSelector::prefetch(this->nodes, Q.front().node_index);
+        }
         switch (e.action) {
             case Infection:
 //                std::cout << ".";
@@ -83,92 +179,76 @@ void Simulation::simulate() {
             this->recover(e);
                 break;
         }
-        Q.pop();
+    }
+    while (next_day_ <= t) {
+        this->close_day();
+    }
+    time_ = std::max(time_, t);
+}
+
+void Simulation::close_day() {
+    DayStats row = this->day_stats(next_day_++);
+    this->trajectory_.push_back(row);
+    if (!cfg.quiet) {
+        write_row(std::cout, row);
+    }
+    if (this->output.is_open()) {
+        write_row(this->output, row);
     }
 }
 
 void Simulation::infect(event incoming_event) {
-    node& incoming_node = incoming_event.node_index >= 0 ? this->nodes.at(incoming_event.node_index) : tourist_node;
-    // Determine susceptibility
-    double tau = incoming_event.time - incoming_node.last_recovery_time;
-    double susceptibility_value;
-    if (incoming_event.node_index == -1) { // Tourist node always susceptible (or use its own property)
-        susceptibility_value = tourist_node.susceptibility;
-    } else if (incoming_node.last_recovery_time <= 0 && incoming_node.recovery_count == 0) { // Never infected before
-        susceptibility_value = cfg.susc_initial;
-    } else { // Previously infected, calculate based on time since last recovery
-        susceptibility_value = tau > 0 ? this->susceptibility_func_(tau) : 0; // tau can be negative if recovery time is in the future
-    }
-
-    double rand_uni = epi::uniform();
-    if (rand_uni > susceptibility_value) {
-        // not infected
+    node& incoming_node = incoming_event.node_index >= 0 ? this->nodes.mut(incoming_event.node_index) : tourist_node;
+    const Contagion::Attempt attempt = this->contagion_.attempt(incoming_node, incoming_event.node_index,
+                                                                incoming_event.time);
+    if (!attempt.infected) {
         return;
     }
 
-    // infected
-
-    incoming_node.infected = true;
-
-    // setting up recovery for the currently infected node
-    double recovery_length = this->recovery_func_(incoming_event.time);
-
-    if (incoming_event.node_index >=0) { // Regular nodes update their state
-        incoming_node.last_recovery_time = incoming_event.time + recovery_length;
-        incoming_node.recovery_count++;
-
-        // push recovery event
+    if (incoming_event.node_index >= 0) { // the tourist node has no recovery to track
         event new_recovery_event = {incoming_node.last_recovery_time, incoming_node.index, Recovery};
-        Q.push(new_recovery_event);
+        push_event(new_recovery_event);
     }
-    // Tourist node state doesn't need to be tracked in the same way for recovery
 
-    int day = (int) incoming_event.time;
-    if (!this->cases_by_day.count(day)) {
-        this->cases_by_day[day] = 1;
-        // todo output count by previous day, or collect other statistics
-        if (day > 0) {
-            this->dump_state(day, std::cout);
-            this->dump_state(day, this->output);
-        }
-    } else {
-        this->cases_by_day[day] = this->cases_by_day[day] + 1;
+    const auto day = (size_t) incoming_event.time;
+    if (day >= this->cases_by_day.size()) { // t_max raised since the run started (e.g. on resume)
+        this->cases_by_day.resize(day + 1, 0);
     }
+    this->cases_by_day[day]++;
 
-    // spreading infection to other nodes
-    // The 'cfg.beta' passed to get_inf_times is used as the base rate for Poisson generation of potential contact times.
-
-    std::vector<double> inf_times = this->get_inf_times(cfg.beta, recovery_length);
-
-    for (double t_inf : inf_times) {
-        double t_actual_infection = incoming_event.time + t_inf;
-        if (t_actual_infection > cfg.t_max) continue; // Don't schedule events past t_max
-
-        node& target = this->select_contact();
-        // infection event for the target
-        event new_infection_event = {t_actual_infection, target.index, Infection};
-        Q.push(new_infection_event);
-        
+    // spreading infection to other nodes, up to t_max
+    this->contagion_.spread(attempt, incoming_event.time);
+    const std::vector<double>& delays = this->contagion_.delays();
+    const std::vector<int>& contacts = this->contagion_.contacts();
+    for (size_t i = 0; i < delays.size(); i++) {
+        event new_infection_event = {incoming_event.time + delays[i], contacts[i], Infection};
+        push_event(new_infection_event);
     }
 }
 
 void Simulation::recover(event incoming_event) {
-    node& incoming_node = this->nodes.at(incoming_event.node_index);
+    node& incoming_node = this->nodes.mut(incoming_event.node_index);
     incoming_node.infected = false;
 }
 
-node& Simulation::select_contact() {
-    std::uniform_int_distribution<> idist(0, (int) this->nodes.size() - 1);
-    int i = idist(epi::mt());
-    return this->nodes.at(i);
+void Simulation::dump_state(int day, std::ostream& out) {
+    write_row(out, this->day_stats(day));
 }
 
-void Simulation::dump_state(int day, std::ostream& out) {
+void Simulation::write_row(std::ostream& out, const DayStats& row) {
+    out << row.day << ","
+        << row.cases << ","
+        << row.infected << ","
+        << row.avg_susceptibility << std::endl;
+}
+
+DayStats Simulation::day_stats(int day) const {
     int infected_count = 0; // Count of currently infectious individuals
     double total_susceptibility = 0;
+    double block_susceptibility = 0; // summed per NodeStore block, then over blocks, as the partitioned engines do
     double current_time_for_stats = static_cast<double>(day-1); // Stats for the completed day
 
-    for (const node& n : this->nodes) {
+    this->nodes.for_each([&](const node& n) {
         // A node is considered infectious if its last_recovery_time is in the future
         // relative to current_time_for_stats, but not further than inf_length ago from that future recovery time.
         // Essentially, current_time_for_stats < n.last_recovery_time AND n.last_recovery_time - current_time_for_stats <= cfg.inf_length
@@ -191,13 +271,17 @@ void Simulation::dump_state(int day, std::ostream& out) {
             double time_since_immunity_waning_started = current_time_for_stats - n.last_recovery_time;
             susceptibility_value = this->susceptibility_func_(time_since_immunity_waning_started);
         }
-        total_susceptibility += susceptibility_value;
-    }
+        block_susceptibility += susceptibility_value;
+        if ((n.index & (NodeStore::block_size - 1)) == NodeStore::block_size - 1) {
+            total_susceptibility += block_susceptibility;
+            block_susceptibility = 0;
+        }
+    });
+    total_susceptibility += block_susceptibility;
     double avg_susceptibility = this->nodes.empty() ? 0 : total_susceptibility / (double) this->nodes.size();
-    
-    out << day - 1 << ","
-        << (this->cases_by_day.count(day - 1) ? this->cases_by_day.at(day - 1) : 0) << ","
-        << infected_count << ","
-        << avg_susceptibility << std::endl;
-    out.flush();
+
+    return {day - 1,
+            day - 1 < (int) this->cases_by_day.size() ? this->cases_by_day[day - 1] : 0,
+            infected_count,
+            avg_susceptibility};
 }
@@ -1,99 +1,163 @@
 #pragma once
 
 #include <random>
-#include <queue>
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <functional> // Required for std::function
+#include <memory>
 #include "Common.h"
 #include "util.h"
+#include "fastmath.h"
+#include "Kernel.h"
+#include "ContactSelector.h"
+#include "Contagion.h"
+#include "NodeStore.h"
 
 class Simulation {
 private:
     config& cfg;
     std::ofstream output;
 
-    std::vector<node> nodes = {}; // all nodes vector (the source of truth)
-    std::priority_queue<event, std::vector<event>, std::greater<>> Q = {};
-    std::map<int, int> cases_by_day;
+    NodeStore nodes; // all nodes (the source of truth), shared copy-on-write with snapshots
+    std::vector<event> Q = {}; // min-heap on event time (std::push_heap/pop_heap with std::greater)
+    std::vector<int> cases_by_day; // new cases by day, days 0..t_max
+    std::vector<DayStats> trajectory_; // one row per completed day
+    int next_day_ = 1;                 // the row of day next_day_ - 1 is due at time next_day_
+    long events_processed_ = 0;
+    double time_ = 0; // run_until() has processed everything up to here
+
+    // Source of spontaneous (imported) infections; per instance so that simulations can run concurrently
+    node tourist_node = {.index = -1, .exposures = 0, .infectivity = 1.0, .susceptibility = 1.0,
+                         .last_recovery_time = 0, .recovery_count = 0, .infected = true};
 
     // Store the functional objects
-    std::function<double(double)> infectivity_func_;
+    std::shared_ptr<const epi::Kernel> kernel_; // contact times, shared between simulations of one profile
     std::function<double(double)> susceptibility_func_;
-    std::function<double(double)> recovery_func_;
+    Contagion contagion_; // the infection rules, with the contact selector and scratch
+
+    std::vector<uint64_t> rng_prefix_; // first random words of the run, e.g. a quasi-random point
+    epi::BlockRng rng_;                // this run's generator, installed in the thread's RNG while it runs
 
     void infect(event incoming_event);
     void recover(event incoming_event);
+    void close_day();
+    void clear_state();
 
-    double precomputed_integral_;
-    double precomputed_max_value_;
+    void push_event(const event& e) {
+        Q.push_back(e);
+        std::push_heap(Q.begin(), Q.end(), std::greater<>());
+    }
 
-    void compute_integral_numerically(double inf_length) {
-        const int n_steps = 1000;
-        double dt = inf_length / n_steps;
-        double integral = 0.0;
-        double max_val = 0.0;
+    event pop_event() {
+        std::pop_heap(Q.begin(), Q.end(), std::greater<>());
+        event e = Q.back();
+        Q.pop_back();
+        return e;
+    }
 
-        // Trapezoidal rule + max finding
-        double prev_val = infectivity_func_(0.0);
-        max_val = prev_val;
+public:
+    explicit Simulation(config& cfg, std::function<double(double)> infectivity_func,
+        std::function<double(double)> susc_func,
+        epi::RecoverySampler recovery_func);
 
-        for (int i = 1; i <= n_steps; ++i) {
-            double t = i * dt;
-            double curr_val = infectivity_func_(t);
+    /// Uses the profile's direct sampler (when it has one) for contact times instead of thinning.
+    explicit Simulation(config& cfg, const InfectivityProfile& infectivity_profile,
+        std::function<double(double)> susc_func,
+        epi::RecoverySampler recovery_func);
 
-            integral += 0.5 * (prev_val + curr_val) * dt;
-            max_val = std::max(max_val, curr_val);
-            prev_val = curr_val;
-        }
+    explicit Simulation(config& cfg, const Model& model);
 
-        precomputed_integral_ = integral;
-        precomputed_max_value_ = max_val;
-    }
+    /// Shares a prebuilt kernel, which must have been built for cfg.inf_length (the model's profile is not used).
+    explicit Simulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel);
 
-public:
-    explicit Simulation(config& cfg, std::function<double(double)> infectivity_func,
+    explicit Simulation(config& cfg, std::shared_ptr<const epi::Kernel> kernel,
         std::function<double(double)> susc_func,
-        std::function<double(double)> recovery_func);
+        epi::RecoverySampler recovery_func);
+
+    /// Complete state of a run at some time: what a continuation needs besides the config and model.
+    /// Snapshots share node blocks with the simulation copy-on-write, so taking one costs about the size of the
+    /// event queue, not of the population.
+    struct Snapshot {
+        NodeStore nodes;
+        std::vector<event> queue;
+        std::vector<int> cases_by_day;
+        std::vector<DayStats> trajectory;
+        int next_day;
+        node tourist;
+        long events_processed;
+        epi::BlockRng rng;
+        double time;
+    };
+
+    /// Continues `snapshot` under `cfg` (which may change e.g. beta, but not N) from the snapshot's time.
+    /// Days already completed are written to cfg.output_file first.
+    explicit Simulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                        const Snapshot& snapshot);
 
     ~Simulation();
 
+    /// start(), then run_until(t_max).
     void simulate();
 
-    void dump_state(int day, std::ostream& out);
+    /// Seeds the run and schedules the initial and spontaneous infections at time 0.
+    void start();
 
-    [[nodiscard]]
-    std::vector<double> get_inf_times(double beta, double inf_length) const {
-        std::vector<double> result;
+    /// Processes every event up to time `t` and closes the days that end by then. Running to T1 and then to T2
+    /// gives exactly the run straight to T2.
+    void run_until(double t);
 
-        // Handle edge cases
-        if (beta <= 0 || precomputed_integral_ <= 0 || precomputed_max_value_ <= 0) {
-            return result;
-        }
+    [[nodiscard]] double time() const { return time_; }
 
-        // Properly normalized rate for thinning
-        double adjusted_rate = (beta * inf_length) * precomputed_max_value_ / precomputed_integral_;
+    [[nodiscard]] Snapshot snapshot() const;
 
-        double t = 0;
-        while (t < inf_length) {
-            double u = epi::uniform();
-            t = t - log(u) / adjusted_rate;
+    /// Restarts in place as a new run of the current config on (seed, stream), which are stored into it; other
+    /// fields (beta, N, output_file, ...) may be changed in the config beforehand. Node blocks, the event queue and
+    /// the statistics keep their storage and the kernel is kept, so back-to-back replicas allocate nothing.
+    /// Clears the RNG prefix. Call start() (or simulate()) next.
+    void reset(uint64_t seed, uint64_t stream);
 
-            if (t < inf_length) {
-                double rate_at_t = infectivity_func_(t);
-                double s = epi::uniform();
+    /// Continues on a fresh stream from here, e.g. to make the forks of one snapshot independent.
+    void reseed_rng(uint64_t seed, uint64_t stream) {
+        rng_.reseed(seed, stream);
+    }
 
-                if (s < rate_at_t / precomputed_max_value_) {
-                    result.push_back(t);
-                }
-            }
-        }
-        return result;
+    /// The run's first random words (seed placement, the first infections' contacts and recovery draws)
+    /// will be `words` instead of generated ones.
+    void set_rng_prefix(std::vector<uint64_t> words) {
+        rng_prefix_ = std::move(words);
+    }
+
+    /// Statistics row of day `day` - 1, taken at time `day`.
+    [[nodiscard]] DayStats day_stats(int day) const;
+
+    void dump_state(int day, std::ostream& out);
+
+    static void write_row(std::ostream& out, const DayStats& row);
+
+    [[nodiscard]]
+    const std::vector<int>& get_cases_by_day() const {
+        return cases_by_day;
+    }
+
+    /// Events popped from the queue so far: the run's cost, independent of the machine.
+    [[nodiscard]] long events_processed() const {
+        return events_processed_;
+    }
+
+    /// Rows of all days completed so far (every day up to t_max once simulate() returns).
+    [[nodiscard]]
+    const std::vector<DayStats>& get_trajectory() const {
+        return trajectory_;
+    }
+
+    [[nodiscard]]
+    std::vector<double> get_inf_times(double beta, double inf_length) const {
+        return kernel_->inf_times(beta, inf_length);
     }
 
     static double get_inter_event_time_poisson(double rate) {
-        const double u = epi::uniform();
-        return - log(u) / rate;
+        return epi::exponential() / rate;
     }
 
     [[nodiscard]]
@@ -101,8 +165,7 @@ public:
         std::vector<double> result;
         double t = 0;
         while (t < cfg.t_max) {
-            double u = epi::uniform();
-            t = t - log(u) / lambda;
+            t = t + epi::exponential() / lambda;
             if (t < cfg.t_max) {
                 result.push_back(t);
             }
@@ -123,5 +186,8 @@ public:
         return result;
     }
 
-    node &select_contact();
+    /// Index of a uniformly chosen contact (the node record itself is not touched).
+    int select_contact() {
+        return contagion_.select_contact();
+    }
 };
@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace epi {
+
+/// Fixed set of worker threads with work stealing. Submitted tasks are dealt round-robin onto per-worker
+/// deques; a worker takes tasks from the front of its own deque and, once that is empty, steals from the front
+/// of another's, so a worker stuck on one long replica never holds back the tasks queued behind it.
+/// Tasks submitted in decreasing cost order are therefore started roughly longest first.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) {
+        threads = std::max(1, threads);
+        for (int i = 0; i < threads; i++) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (int i = 0; i < threads; i++) {
+            workers_.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] int size() const { return (int) workers_.size(); }
+
+    void submit(std::function<void()> task) {
+        Queue& queue = *queues_[next_queue_++ % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_++;
+            queued_++;
+        }
+        wake_.notify_one();
+    }
+
+    /// Blocks until every submitted task has finished.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+    /// Runs body(i) for i in [0, n) on the pool and waits for all of them. Indices are submitted in order.
+    void parallel_for(int n, const std::function<void(int)>& body) {
+        for (int i = 0; i < n; i++) {
+            submit([&body, i] { body(i); });
+        }
+        wait();
+    }
+
+    /// Tasks taken from another worker's deque so far.
+    [[nodiscard]] long steals() const { return steals_; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take(int self, std::function<void()>& task) {
+        const int n = (int) queues_.size();
+        for (int k = 0; k < n; k++) {
+            Queue& queue = *queues_[(self + k) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                if (k > 0) {
+                    steals_++;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(int self) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+                if (queued_ == 0) {
+                    return;
+                }
+                queued_--; // claims one task, which is in some deque by now
+            }
+            std::function<void()> task;
+            while (!take(self, task)) {
+                std::this_thread::yield(); // a task is left for every claim, even if others raced us to this one
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                pending_--;
+            }
+            idle_.notify_all();
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_{0}; // tasks may submit further tasks
+    std::atomic<long> steals_{0};
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    int pending_ = 0; // submitted and not finished
+    int queued_ = 0;  // submitted and not yet claimed by a worker
+    bool stopping_ = false;
+};
+
+/// Reusable barrier for a fixed number of threads (std::barrier is C++20). The last thread to arrive runs the
+/// completion step before any is released, so it sees everything the others did in the phase and they all see
+/// what it does.
+class Barrier {
+public:
+    explicit Barrier(int count) : count_(count) {}
+
+    Barrier(const Barrier&) = delete;
+    Barrier& operator=(const Barrier&) = delete;
+
+    void arrive_and_wait() {
+        arrive_and_wait([] {});
+    }
+
+    template <class Completion>
+    void arrive_and_wait(Completion&& on_completion) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const long generation = generation_;
+        if (++arrived_ == count_) {
+            on_completion();
+            arrived_ = 0;
+            generation_++;
+            lock.unlock();
+            released_.notify_all();
+            return;
+        }
+        released_.wait(lock, [&] { return generation_ != generation; });
+    }
+
+private:
+    const int count_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+    int arrived_ = 0;
+    long generation_ = 0;
+};
+
+} // namespace epi
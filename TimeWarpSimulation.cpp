@@ -0,0 +1,392 @@
+#include "TimeWarpSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include "Contagion.h"
+#include "Mailbox.h"
+#include "Partition.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+namespace {
+
+constexpr double never = std::numeric_limits<double>::infinity();
+
+/// An event with the identity needed to cancel it: the infection attempt that scheduled it and its place among
+/// that attempt's results (-1 for the recovery, i for the i-th contact).
+struct Message {
+    double time;
+    int node_index;
+    Action action;
+    uint64_t cause;
+    int slot;
+    bool anti; // cancels the message with the same identity
+};
+
+constexpr uint64_t initial_cause = ~(uint64_t) 0; // initial and spontaneous infections, numbered by slot
+
+/// Events are processed by time, ties broken by identity, so every partitioning commits them in the same order.
+struct Before {
+    bool operator()(const Message& a, const Message& b) const {
+        return std::tie(a.time, a.cause, a.slot, a.node_index) < std::tie(b.time, b.cause, b.slot, b.node_index);
+    }
+};
+
+} // namespace
+
+/// A Time Warp logical process: the nodes of one part with its pending events, and the history needed to undo
+/// the events it has processed since the global virtual time.
+class TimeWarpPartition {
+public:
+    TimeWarpPartition(const config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                      PartitionMap map, int part)
+        : map_(map),
+          part_(part),
+          begin_(map.begin(part)),
+          nodes_((size_t) (map.end(part) - map.begin(part)), {0, 0, 0.0, cfg.susc_initial, 0.0, 0, false}),
+          cases_by_day_((size_t) std::max(0.0, std::floor(cfg.t_max)) + 1, 0),
+          contagion_(cfg, model, std::move(kernel)) {
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            nodes_[i].index = begin_ + (int) i;
+        }
+    }
+
+    void push(const Message& m) { pending_.insert(m); }
+
+    /// Sends to other parts through `sender`, from the thread running this part.
+    void connect(epi::Mailboxes<Message>::Sender* sender) { sender_ = sender; }
+
+    /// Speculatively processes the pending events before `end` (and at it if `inclusive`).
+    void run(double end, bool inclusive) {
+        epi::RngScope scope(rng_);
+        while (!pending_.empty()) {
+            const Message m = *pending_.begin();
+            if (m.time > end || (m.time == end && !inclusive)) {
+                break;
+            }
+            pending_.erase(pending_.begin());
+            events_processed_++;
+            process(m);
+        }
+    }
+
+    /// Applies a message from another part, rolling back past a straggler or a cancelled event.
+    void receive(const Message& m) {
+        if (!m.anti) {
+            roll_back(m, false);
+            pending_.insert(m);
+        } else if (pending_.erase(m) == 0) {
+            roll_back(m, true); // already processed: undo it (and what followed) first
+            pending_.erase(m);
+        }
+    }
+
+    /// Starts tracking the earliest message sent from now on, which may still be in flight at the next earliest().
+    void track_sent() { earliest_sent_ = never; }
+
+    /// Earliest event this part has yet to process, or has sent since track_sent().
+    [[nodiscard]] double earliest() const {
+        return std::min(pending_.empty() ? never : pending_.begin()->time, earliest_sent_);
+    }
+
+    /// Forgets the saved state of events before the global virtual time: they can no longer be rolled back.
+    void fossil_collect(double gvt) {
+        while (!history_.empty() && history_.front().event.time < gvt) {
+            for (int k = 0; k < history_.front().outputs; k++) {
+                outputs_.pop_front();
+            }
+            history_.pop_front();
+        }
+    }
+
+    [[nodiscard]] Partition::Tally tally(int day) const {
+        return contagion_.tally(nodes_.data(), nodes_.size(), day);
+    }
+
+    [[nodiscard]] const std::vector<int>& cases_by_day() const { return cases_by_day_; }
+    [[nodiscard]] long saved_events() const { return (long) history_.size(); }
+    [[nodiscard]] long events_processed() const { return events_processed_; }
+    [[nodiscard]] long events_rolled_back() const { return events_rolled_back_; }
+    [[nodiscard]] long anti_messages() const { return anti_messages_; }
+
+private:
+    // The fields of a node an event may change
+    struct Saved {
+        double last_recovery_time;
+        int recovery_count;
+        int exposures;
+        bool infected;
+    };
+
+    struct Record {
+        Message event;
+        Saved saved;
+        int outputs;  // messages it sent, the last ones in outputs_ when it is the newest record
+        bool counted; // it was a new case
+    };
+
+    struct Output {
+        int part;
+        Message event;
+    };
+
+    node& target(int index) {
+        return index >= 0 ? nodes_[index - begin_] : tourist_node_;
+    }
+
+    void process(const Message& m) {
+        node& n = target(m.node_index);
+        Record record = {m, {n.last_recovery_time, n.recovery_count, n.exposures, n.infected}, 0, false};
+        if (m.action == Infection) {
+            infect(m, n, record);
+        } else {
+            n.infected = false;
+        }
+        history_.push_back(record);
+    }
+
+    void send(const Message& m, Record& record) {
+        const int owner = map_.owner(m.node_index);
+        if (owner == part_) {
+            pending_.insert(m);
+        } else {
+            post(owner, m);
+        }
+        outputs_.push_back({owner, m});
+        record.outputs++;
+    }
+
+    void post(int part, const Message& m) {
+        sender_->send(part, m);
+        earliest_sent_ = std::min(earliest_sent_, m.time);
+    }
+
+    void infect(const Message& m, node& n, Record& record) {
+        const Contagion::Attempt attempt = contagion_.attempt(n, m.node_index, m.time);
+        if (!attempt.infected) {
+            return;
+        }
+        if (m.node_index >= 0) {
+            send({n.last_recovery_time, n.index, Recovery, attempt.key, -1, false}, record);
+        }
+
+        const auto day = (size_t) m.time;
+        if (day >= cases_by_day_.size()) {
+            cases_by_day_.resize(day + 1, 0);
+        }
+        cases_by_day_[day]++;
+        record.counted = true;
+
+        contagion_.spread(attempt, m.time);
+        const std::vector<double>& delays = contagion_.delays();
+        for (size_t i = 0; i < delays.size(); i++) {
+            send({m.time + delays[i], contagion_.contacts()[i], Infection, attempt.key, (int) i, false}, record);
+        }
+    }
+
+    // Undoes the processed events after m (and m itself if `including`), newest first
+    void roll_back(const Message& m, bool including) {
+        Before before;
+        while (!history_.empty()) {
+            const Message& newest = history_.back().event;
+            if (!before(m, newest) && !(including && !before(newest, m))) {
+                break;
+            }
+            undo_newest();
+        }
+    }
+
+    void undo_newest() {
+        const Record record = history_.back();
+        history_.pop_back();
+        for (int k = 0; k < record.outputs; k++) {
+            Output output = outputs_.back();
+            outputs_.pop_back();
+            if (output.part == part_) {
+                pending_.erase(output.event); // later than its cause, so not processed, or undone already
+            } else {
+                output.event.anti = true;
+                post(output.part, output.event);
+                anti_messages_++;
+            }
+        }
+        node& n = target(record.event.node_index);
+        n.last_recovery_time = record.saved.last_recovery_time;
+        n.recovery_count = record.saved.recovery_count;
+        n.exposures = record.saved.exposures;
+        n.infected = record.saved.infected;
+        if (record.counted) {
+            cases_by_day_[(size_t) record.event.time]--;
+        }
+        pending_.insert(record.event);
+        events_rolled_back_++;
+    }
+
+    PartitionMap map_;
+    int part_;
+    int begin_;
+
+    std::vector<node> nodes_;
+    node tourist_node_ = {.index = -1, .exposures = 0, .infectivity = 1.0, .susceptibility = 1.0,
+                          .last_recovery_time = 0, .recovery_count = 0, .infected = true};
+    std::set<Message, Before> pending_;
+    std::deque<Record> history_; // processed events not yet committed, oldest first
+    std::deque<Output> outputs_; // messages sent by the events in history_, in the same order
+    epi::Mailboxes<Message>::Sender* sender_ = nullptr;
+    double earliest_sent_ = never;
+    std::vector<int> cases_by_day_;
+    long events_processed_ = 0;
+    long events_rolled_back_ = 0;
+    long anti_messages_ = 0;
+
+    epi::BlockRng rng_; // every draw comes from a per-attempt substream; this only hosts them
+    Contagion contagion_; // attempts as Simulation::infect in --crn mode, so processing an event again repeats it
+};
+
+TimeWarpSimulation::TimeWarpSimulation(config& conf, const Model& model, std::shared_ptr<const epi::Kernel> kernel,
+                                       int threads)
+    : cfg(conf), model_(model), kernel_(std::move(kernel)) {
+    const PartitionMap map = {conf.N, std::max(1, std::min(threads, conf.N))};
+    for (int p = 0; p < map.parts; p++) {
+        partitions_.push_back(std::make_unique<TimeWarpPartition>(conf, model_, kernel_, map, p));
+    }
+    if (!conf.output_file.empty()) {
+        this->output = std::ofstream(conf.output_file);
+    }
+}
+
+TimeWarpSimulation::~TimeWarpSimulation() = default;
+
+void TimeWarpSimulation::start() {
+    const PartitionMap map = {cfg.N, (int) partitions_.size()};
+    int slot = 0;
+    for (const event& e : Contagion::start_events(cfg)) {
+        partitions_[map.owner(e.node_index)]->push({e.time, e.node_index, e.action, initial_cause, slot++, false});
+    }
+}
+
+void TimeWarpSimulation::simulate() {
+    this->start();
+    const int parts = (int) partitions_.size();
+    std::vector<double> earliest(parts);
+    std::vector<Partition::Tally> tallies(parts);
+    double window_end = std::min((double) next_day_, cfg.t_max);
+    double gvt = 0;
+    bool window_done = false, done = false;
+    rounds_ = 0;
+    max_saved_events_ = 0;
+    epi::Barrier barrier(parts);
+    epi::Mailboxes<Message> mail(parts);
+
+    auto work = [&](int p) {
+        TimeWarpPartition& partition = *partitions_[p];
+        epi::Mailboxes<Message>::Sender sender(mail, p);
+        partition.connect(&sender);
+        for (;;) {
+            const bool last = window_end >= cfg.t_max;
+            partition.fossil_collect(gvt);
+            partition.run(window_end, last);
+            sender.flush();
+            barrier.arrive_and_wait();
+            // Everything sent while running has arrived. Anti-messages sent while receiving may arrive now or in
+            // the next round, so they count towards the GVT until then.
+            partition.track_sent();
+            mail.receive(p, [&](const Message& m) { partition.receive(m); });
+            sender.flush();
+            earliest[p] = partition.earliest();
+            barrier.arrive_and_wait([&] {
+                rounds_++;
+                for (const auto& part : partitions_) {
+                    max_saved_events_ = std::max(max_saved_events_, part->saved_events());
+                }
+                gvt = *std::min_element(earliest.begin(), earliest.end());
+                window_done = gvt > window_end || (gvt == window_end && !last);
+            });
+            if (!window_done) {
+                continue;
+            }
+            // Nothing before the window end is left anywhere: the part's state there is final
+            if (window_end == next_day_) {
+                tallies[p] = partition.tally(next_day_);
+            }
+            barrier.arrive_and_wait([&] {
+                if (window_end == next_day_) {
+                    this->close_day(tallies);
+                }
+                window_done = false;
+                if (last) {
+                    done = true;
+                } else {
+                    window_end = std::min((double) next_day_, cfg.t_max);
+                }
+            });
+            if (done) {
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int p = 1; p < parts; p++) {
+        workers.emplace_back(work, p);
+    }
+    work(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void TimeWarpSimulation::close_day(const std::vector<Partition::Tally>& tallies) {
+    const int day = next_day_++;
+    int cases = 0, infected_total = 0;
+    double susceptibility_total = 0;
+    for (size_t p = 0; p < partitions_.size(); p++) {
+        const std::vector<int>& part_cases = partitions_[p]->cases_by_day();
+        cases += day - 1 < (int) part_cases.size() ? part_cases[day - 1] : 0;
+        infected_total += tallies[p].infected;
+        for (double block : tallies[p].susceptibility) {
+            susceptibility_total += block;
+        }
+    }
+    DayStats row = {day - 1, cases, infected_total, cfg.N > 0 ? susceptibility_total / cfg.N : 0};
+    trajectory_.push_back(row);
+    if (!cfg.quiet) {
+        Simulation::write_row(std::cout, row);
+    }
+    if (this->output.is_open()) {
+        Simulation::write_row(this->output, row);
+    }
+}
+
+std::vector<int> TimeWarpSimulation::get_cases_by_day() const {
+    std::vector<int> result;
+    for (const auto& partition : partitions_) {
+        const std::vector<int>& part_cases = partition->cases_by_day();
+        if (result.size() < part_cases.size()) {
+            result.resize(part_cases.size(), 0);
+        }
+        for (size_t d = 0; d < part_cases.size(); d++) {
+            result[d] += part_cases[d];
+        }
+    }
+    return result;
+}
+
+TimeWarpSimulation::Counters TimeWarpSimulation::counters() const {
+    Counters result;
+    result.rounds = rounds_;
+    for (const auto& partition : partitions_) {
+        result.events_processed += partition->events_processed();
+        result.events_rolled_back += partition->events_rolled_back();
+        result.anti_messages += partition->anti_messages();
+    }
+    result.max_saved_events = max_saved_events_;
+    return result;
+}
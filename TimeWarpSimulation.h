@@ -0,0 +1,63 @@
+#pragma once
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Common.h"
+#include "Kernel.h"
+#include "Partition.h"
+
+class TimeWarpPartition;
+
+/// One run on several threads with optimistic synchronization (Time Warp, Jefferson 1985). The nodes are split
+/// into one partition per thread as in ParallelSimulation, but partitions do not wait for each other within a
+/// day: each processes its events speculatively and, when an infection arrives in its past (a straggler), rolls
+/// back the events after it. Rollback restores the few node fields an event changes, saved as it is processed,
+/// and cancels what the undone events caused: their own follow-up events directly, those sent to other
+/// partitions with anti-messages. Partitions exchange messages in rounds; between rounds the global virtual time
+/// (the earliest unprocessed event anywhere) is computed and the saved state before it is discarded (fossil
+/// collection), so memory stays bounded by the events of about one day. Days close once no partition has
+/// anything left before the day boundary.
+///
+/// Every infection attempt draws from its own substream as in --crn mode, so re-executing an event after a
+/// rollback repeats it exactly: a run gives the same rows as the sequential engine with --crn, whatever the
+/// number of threads.
+class TimeWarpSimulation {
+public:
+    TimeWarpSimulation(config& cfg, const Model& model, std::shared_ptr<const epi::Kernel> kernel, int threads);
+    ~TimeWarpSimulation();
+
+    TimeWarpSimulation(const TimeWarpSimulation&) = delete;
+    TimeWarpSimulation& operator=(const TimeWarpSimulation&) = delete;
+
+    /// Runs from time 0 to t_max (once per instance).
+    void simulate();
+
+    [[nodiscard]] int partitions() const { return (int) partitions_.size(); }
+
+    [[nodiscard]] const std::vector<DayStats>& get_trajectory() const { return trajectory_; }
+    [[nodiscard]] std::vector<int> get_cases_by_day() const;
+
+    /// Work done by the last run.
+    struct Counters {
+        long events_processed = 0; // including events processed again after a rollback
+        long events_rolled_back = 0;
+        long anti_messages = 0;
+        long rounds = 0;
+        long max_saved_events = 0; // largest history held by one partition at a round boundary
+    };
+    [[nodiscard]] Counters counters() const;
+
+private:
+    void start();
+    void close_day(const std::vector<Partition::Tally>& tallies);
+
+    config& cfg;
+    std::ofstream output;
+    Model model_;
+    std::shared_ptr<const epi::Kernel> kernel_;
+    std::vector<std::unique_ptr<TimeWarpPartition>> partitions_;
+    std::vector<DayStats> trajectory_;
+    int next_day_ = 1;
+    long rounds_ = 0;
+    long max_saved_events_ = 0;
+};
@@ -0,0 +1,145 @@
+#include "bench.h"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Common.h"
+#include "Mailbox.h"
+
+namespace epi::bench {
+
+namespace {
+
+// Runs `body(thread)` on `threads` threads started together and returns the wall time in seconds.
+template <class Body>
+double timed(int threads, Body body) {
+    std::atomic<int> ready{0};
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            ready++;
+            while (ready.load() < threads) {
+                std::this_thread::yield();
+            }
+            body(t);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Result {
+    double seconds;
+    long received;
+    long checksum;
+};
+
+// Messages carry (sender, sequence) in node_index and time, so loss, duplication and reordering per sender
+// show up in the checksum and in the order check.
+Result run_mailboxes(int threads, long messages) {
+    Mailboxes<event> mail(threads);
+    std::atomic<long> received{0}, checksum{0};
+    std::atomic<bool> in_order{true};
+    const long total = messages * threads;
+    double seconds = timed(threads, [&](int self) {
+        Mailboxes<event>::Sender sender(mail, self);
+        std::vector<double> last(threads, -1);
+        uint64_t state = 0x9E3779B97F4A7C15ULL * (self + 1);
+        auto drain = [&] {
+            long sum = 0;
+            received += (long) mail.receive(self, [&](const event& e) {
+                sum += e.node_index + (long) e.time;
+                if (e.time <= last[e.node_index]) in_order = false;
+                last[e.node_index] = e.time;
+            });
+            checksum += sum;
+        };
+        for (long i = 0; i < messages; i++) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            int destination = (int) ((state * 0x2545F4914F6CDD1DULL) >> 33) % threads;
+            sender.send(destination, {(double) i, self, Infection});
+            if ((i & 1023) == 1023) {
+                drain();
+            }
+        }
+        sender.flush();
+        while (received.load() < total) {
+            drain();
+            std::this_thread::yield();
+        }
+    });
+    return {seconds, received.load(), in_order ? checksum.load() : -1};
+}
+
+Result run_locked(int threads, long messages) {
+    struct alignas(64) Box {
+        std::mutex mutex;
+        std::vector<event> events;
+    };
+    std::vector<Box> boxes(threads);
+    std::atomic<long> received{0}, checksum{0};
+    const long total = messages * threads;
+    double seconds = timed(threads, [&](int self) {
+        uint64_t state = 0x9E3779B97F4A7C15ULL * (self + 1);
+        std::vector<event> taken;
+        auto drain = [&] {
+            long sum = 0;
+            {
+                std::lock_guard<std::mutex> lock(boxes[self].mutex);
+                taken.swap(boxes[self].events);
+            }
+            for (const event& e : taken) {
+                sum += e.node_index + (long) e.time;
+            }
+            received += (long) taken.size();
+            checksum += sum;
+            taken.clear();
+        };
+        for (long i = 0; i < messages; i++) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            int destination = (int) ((state * 0x2545F4914F6CDD1DULL) >> 33) % threads;
+            {
+                std::lock_guard<std::mutex> lock(boxes[destination].mutex);
+                boxes[destination].events.push_back({(double) i, self, Infection});
+            }
+            if ((i & 1023) == 1023) {
+                drain();
+            }
+        }
+        while (received.load() < total) {
+            drain();
+            std::this_thread::yield();
+        }
+    });
+    return {seconds, received.load(), checksum.load()};
+}
+
+} // namespace
+
+int mailboxes(int threads, long messages, std::ostream& out) {
+    // Every sender sends sequence numbers 0 .. messages - 1 once
+    const long expected = threads * (messages * (messages - 1) / 2) + messages * (long) threads * (threads - 1) / 2;
+    bool ok = true;
+    auto report = [&](const char* name, const Result& r) {
+        const bool exact = r.received == messages * threads && r.checksum == expected;
+        ok = ok && exact;
+        out << std::left << std::setw(18) << name << std::right << std::setw(12) << r.received << " messages in "
+            << std::setw(8) << r.seconds << " s  " << std::setw(8) << (double) r.received / r.seconds / 1e6
+            << " M/s" << (exact ? "" : "   LOST, DUPLICATED OR REORDERED") << std::endl;
+    };
+    out << threads << " threads, " << messages << " messages each to random threads" << std::endl;
+    report("lock-free blocks", run_mailboxes(threads, messages));
+    report("mutex + vector", run_locked(threads, messages));
+    return ok ? 0 : 1;
+}
+
+} // namespace epi::bench
@@ -0,0 +1,12 @@
+#pragma once
+#include <ostream>
+
+namespace epi::bench {
+
+/// Standalone benchmark of epi::Mailboxes: `threads` threads each send `messages` events to uniformly random
+/// threads while draining their own mailbox, first through the lock-free mailboxes, then through a
+/// mutex-guarded vector per thread as a baseline. Reports messages per second of both. Returns 0 when every
+/// message arrived exactly once.
+int mailboxes(int threads, long messages, std::ostream& out);
+
+} // namespace epi::bench
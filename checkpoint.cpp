@@ -0,0 +1,305 @@
+#include "checkpoint.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace epi::checkpoint {
+
+namespace {
+
+constexpr char magic[8] = {'E', 'P', 'I', 'C', 'K', 'P', 'T', '\0'};
+
+struct DayCount {
+    int day;
+    int cases;
+};
+
+static_assert(std::is_trivially_copyable_v<node> && std::is_trivially_copyable_v<event>
+              && std::is_trivially_copyable_v<DayStats> && std::is_trivially_copyable_v<BlockRng>,
+              "checkpointed records are stored as raw bytes");
+
+class Out {
+public:
+    explicit Out(const std::string& path) : file_(path, std::ios::binary | std::ios::trunc), path_(path) {
+        if (!file_) throw std::runtime_error("cannot write checkpoint " + path);
+    }
+
+    template <class T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes(&value, sizeof(T));
+    }
+
+    void bytes(const void *data, size_t n) {
+        file_.write(static_cast<const char *>(data), (std::streamsize) n);
+    }
+
+    template <class T>
+    void array(const std::vector<T>& values) {
+        put<uint64_t>(values.size());
+        bytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void string(const std::string& value) {
+        put<uint64_t>(value.size());
+        bytes(value.data(), value.size());
+    }
+
+    void close() {
+        file_.close();
+        if (!file_) throw std::runtime_error("error writing checkpoint " + path_);
+    }
+
+private:
+    std::ofstream file_;
+    std::string path_;
+};
+
+class In {
+public:
+    explicit In(const std::string& path) : file_(path, std::ios::binary), path_(path) {
+        if (!file_) throw std::runtime_error("cannot open checkpoint " + path);
+    }
+
+    template <class T>
+    T get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        bytes(&value, sizeof(T));
+        return value;
+    }
+
+    void bytes(void *data, size_t n) {
+        if (!file_.read(static_cast<char *>(data), (std::streamsize) n)) {
+            throw std::runtime_error("checkpoint " + path_ + " is truncated");
+        }
+    }
+
+    template <class T>
+    std::vector<T> array() {
+        std::vector<T> values(get<uint64_t>());
+        bytes(values.data(), values.size() * sizeof(T));
+        return values;
+    }
+
+    std::string string() {
+        std::string value(get<uint64_t>(), '\0');
+        bytes(value.data(), value.size());
+        return value;
+    }
+
+private:
+    std::ifstream file_;
+    std::string path_;
+};
+
+// The config without its strings, field by field so that the layout does not depend on padding
+void put_config(Out& out, const config& c) {
+    out.put(c.N);
+    for (double x : {c.t_max, c.beta, c.inf_length, c.susc_k, c.susc_l, c.susc_x0, c.inf_scale, c.inf_mean, c.inf_k,
+                     c.sp_lambda, c.susc_initial, c.contact_cache_quantum}) {
+        out.put(x);
+    }
+    out.put(c.n_initial);
+    out.put(c.contact_cache_entries);
+    out.put(c.seed);
+    out.put(c.stream);
+    out.put<uint8_t>(c.crn);
+    out.put<uint8_t>(c.antithetic);
+}
+
+config get_config(In& in) {
+    config c = {};
+    c.N = in.get<int>();
+    for (double *x : {&c.t_max, &c.beta, &c.inf_length, &c.susc_k, &c.susc_l, &c.susc_x0, &c.inf_scale, &c.inf_mean,
+                      &c.inf_k, &c.sp_lambda, &c.susc_initial, &c.contact_cache_quantum}) {
+        *x = in.get<double>();
+    }
+    c.n_initial = in.get<int>();
+    c.contact_cache_entries = in.get<int>();
+    c.seed = in.get<uint64_t>();
+    c.stream = in.get<uint64_t>();
+    c.crn = in.get<uint8_t>() != 0;
+    c.antithetic = in.get<uint8_t>() != 0;
+    return c;
+}
+
+void put_models(Out& out, const ModelChoice& m) {
+    out.string(m.recovery);
+    out.put(m.recovery_mean);
+    out.put(m.recovery_shape);
+    out.string(m.susceptibility);
+    out.put(m.immunity_time);
+    out.string(m.infectivity_file);
+    out.put<uint8_t>(m.fast_math);
+}
+
+ModelChoice get_models(In& in) {
+    ModelChoice m;
+    m.recovery = in.string();
+    m.recovery_mean = in.get<double>();
+    m.recovery_shape = in.get<double>();
+    m.susceptibility = in.string();
+    m.immunity_time = in.get<double>();
+    m.infectivity_file = in.string();
+    m.fast_math = in.get<uint8_t>() != 0;
+    return m;
+}
+
+} // namespace
+
+std::string ModelChoice::describe() const {
+    std::ostringstream text;
+    text.precision(17);
+    text << "--recovery " << recovery;
+    if (recovery != "const") {
+        text << " --recovery-mean " << recovery_mean;
+    }
+    if (recovery == "gamma" || recovery == "erlang") {
+        text << " --recovery-shape " << recovery_shape;
+    }
+    text << " --susceptibility " << susceptibility;
+    if (susceptibility == "exp") {
+        text << " --immunity-time " << immunity_time;
+    }
+    if (!infectivity_file.empty()) {
+        text << " --infectivity-file " << infectivity_file;
+    }
+    text << (fast_math ? " --fast-math" : " --precise-math");
+    return text.str();
+}
+
+void write(const std::string& path, const config& cfg, const ModelChoice& models, const Simulation::Snapshot& state) {
+    const std::string tmp = path + ".tmp";
+    {
+        Out out(tmp);
+        out.bytes(magic, sizeof(magic));
+        out.put(format_version);
+        out.put<uint32_t>(sizeof(node));
+        put_config(out, cfg);
+        put_models(out, models);
+
+        out.put(state.time);
+        out.put(state.next_day);
+        out.put<int64_t>(state.events_processed);
+        out.put(state.tourist);
+        out.put(state.rng);
+
+        out.put<int64_t>(state.nodes.size());
+        int64_t left = state.nodes.size();
+        for (size_t b = 0; left > 0; b++, left -= NodeStore::block_size) {
+            out.bytes(state.nodes.block(b), (size_t) std::min<int64_t>(left, NodeStore::block_size) * sizeof(node));
+        }
+        out.array(state.queue);
+        std::vector<DayCount> cases;
+        for (size_t day = 0; day < state.cases_by_day.size(); day++) {
+            if (state.cases_by_day[day] > 0) cases.push_back({(int) day, state.cases_by_day[day]});
+        }
+        out.array(cases);
+        out.array(state.trajectory);
+        out.close();
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("cannot rename " + tmp + " to " + path);
+    }
+}
+
+Checkpoint read(const std::string& path) {
+    In in(path);
+    char file_magic[sizeof(magic)];
+    in.bytes(file_magic, sizeof(file_magic));
+    if (std::memcmp(file_magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    const auto version = in.get<uint32_t>();
+    if (version != format_version) {
+        throw std::runtime_error(path + ": checkpoint format version " + std::to_string(version) + ", expected "
+                                 + std::to_string(format_version));
+    }
+    if (in.get<uint32_t>() != sizeof(node)) {
+        throw std::runtime_error(path + " was written by an incompatible build");
+    }
+
+    Checkpoint result;
+    result.cfg = get_config(in);
+    result.models = get_models(in);
+    Simulation::Snapshot& state = result.state;
+    state.time = in.get<double>();
+    state.next_day = in.get<int>();
+    state.events_processed = (long) in.get<int64_t>();
+    state.tourist = in.get<node>();
+    state.rng = in.get<BlockRng>();
+
+    const auto n = (int) in.get<int64_t>();
+    if (n != result.cfg.N) {
+        throw std::runtime_error(path + ": node count does not match its config");
+    }
+    state.nodes.assign(n, {});
+    int64_t left = n;
+    for (size_t b = 0; left > 0; b++, left -= NodeStore::block_size) {
+        in.bytes(state.nodes.mutable_block(b), (size_t) std::min<int64_t>(left, NodeStore::block_size) * sizeof(node));
+    }
+    state.queue = in.array<event>();
+    state.cases_by_day.assign((size_t) std::max(0.0, std::floor(result.cfg.t_max)) + 1, 0);
+    for (const DayCount& count : in.array<DayCount>()) {
+        if (count.day < 0) throw std::runtime_error(path + ": bad day in case counts");
+        if ((size_t) count.day >= state.cases_by_day.size()) state.cases_by_day.resize(count.day + 1, 0);
+        state.cases_by_day[count.day] = count.cases;
+    }
+    state.trajectory = in.array<DayStats>();
+    return result;
+}
+
+Writer::Writer(std::string path, ModelChoice models)
+    : path_(std::move(path)), models_(std::move(models)), thread_([this] { work(); }) {}
+
+Writer::~Writer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void Writer::submit(const config& cfg, Simulation::Snapshot state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.emplace(Checkpoint{cfg, models_, std::move(state)});
+    }
+    wake_.notify_all();
+}
+
+void Writer::work() {
+    for (;;) {
+        std::optional<Checkpoint> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || pending_; });
+            if (!pending_) {
+                return;
+            }
+            job.swap(pending_);
+        }
+        try {
+            write(path_, job->cfg, job->models, job->state);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl; // the run goes on; the previous checkpoint stays in place
+        }
+    }
+}
+
+void run(Simulation& simulation, const config& cfg, double every, Writer& writer) {
+    for (double t = (std::floor(simulation.time() / every) + 1) * every; t < cfg.t_max; t += every) {
+        simulation.run_until(t);
+        writer.submit(cfg, simulation.snapshot());
+    }
+    simulation.run_until(cfg.t_max);
+}
+
+} // namespace epi::checkpoint
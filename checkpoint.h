@@ -0,0 +1,74 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include "Common.h"
+#include "Simulation.h"
+
+namespace epi::checkpoint {
+
+/// Format version written into every checkpoint; files of other versions are rejected.
+constexpr uint32_t format_version = 2;
+
+/// The model functions of a run, which live outside its config: the command line options they were built from.
+struct ModelChoice {
+    std::string recovery;         // const, poisson, gamma or erlang
+    double recovery_mean;         // of the random recovery distributions
+    double recovery_shape;        // of gamma and erlang
+    std::string susceptibility;   // sigmoid or exp
+    double immunity_time;         // of exp
+    std::string infectivity_file; // empty: the log-normal curve of the config
+    bool fast_math;
+
+    /// The options that matter for the chosen functions, as they are given on the command line.
+    [[nodiscard]] std::string describe() const;
+};
+
+/// A checkpoint file: the model parameters of `cfg` (everything but output_file and quiet), the model functions
+/// and the engine state. Numbers are stored in the host's byte order.
+struct Checkpoint {
+    config cfg;
+    ModelChoice models;
+    Simulation::Snapshot state;
+};
+
+/// Writes atomically: to `path`.tmp, then renamed over `path`. Throws std::runtime_error on I/O errors.
+void write(const std::string& path, const config& cfg, const ModelChoice& models, const Simulation::Snapshot& state);
+
+/// Throws std::runtime_error on unreadable, truncated or foreign files and on other format versions.
+Checkpoint read(const std::string& path);
+
+/// Writes checkpoints on a background thread. submit() only hands over a snapshot, whose node blocks the
+/// simulation shares copy-on-write, so the simulation pauses for the snapshot and later clones just the blocks
+/// it modifies while the file is being written. If the writer is still busy, a newer submission replaces the
+/// waiting one.
+class Writer {
+public:
+    Writer(std::string path, ModelChoice models);
+    ~Writer(); // writes the last submission before returning
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void submit(const config& cfg, Simulation::Snapshot state);
+
+private:
+    void work();
+
+    std::string path_;
+    ModelChoice models_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::optional<Checkpoint> pending_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+/// Runs `simulation` from its current time to cfg.t_max, submitting a checkpoint every `every` days (of simulated
+/// time) to `writer`.
+void run(Simulation& simulation, const config& cfg, double every, Writer& writer);
+
+} // namespace epi::checkpoint
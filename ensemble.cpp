@@ -0,0 +1,656 @@
+#include "ensemble.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "DayStepSimulation.h"
+#include "ParallelSimulation.h"
+#include "RelaxedSimulation.h"
+#include "Simulation.h"
+#include "TimeWarpSimulation.h"
+#include "ThreadPool.h"
+#include "fastmath.h"
+#include "qmc.h"
+#include "stats.h"
+#include "sweep.h"
+
+namespace epi::ensemble {
+
+RunMetrics measure(const std::vector<int>& cases_by_day, int population) {
+    RunMetrics m = {0.0, 0, 0, false};
+    long total = 0;
+    for (int day = 0; day < (int) cases_by_day.size(); day++) {
+        total += cases_by_day[day];
+        if (cases_by_day[day] > m.peak_cases) {
+            m.peak_cases = cases_by_day[day];
+            m.peak_day = day;
+        }
+    }
+    m.attack_rate = population > 0 ? (double) total / population : 0.0;
+
+    // Waves are counted on the trailing 7-day mean with hysteresis: a wave starts when the mean rises above half
+    // of its maximum and ends when it falls below a quarter of it
+    const int window = 7;
+    const int days = (int) cases_by_day.size();
+    std::vector<double> weekly(days, 0.0);
+    double sum = 0, peak = 0;
+    for (int d = 0; d < days; d++) {
+        sum += cases_by_day[d];
+        if (d >= window) {
+            sum -= cases_by_day[d - window];
+        }
+        weekly[d] = sum / window;
+        peak = std::max(peak, weekly[d]);
+    }
+    int waves = 0;
+    bool in_wave = false;
+    for (double w : weekly) {
+        if (!in_wave && w > 0.5 * peak) {
+            in_wave = true;
+            waves++;
+        } else if (in_wave && w < 0.25 * peak) {
+            in_wave = false;
+        }
+    }
+    m.second_wave = waves >= 2;
+    return m;
+}
+
+void MetricsSummary::add(const RunMetrics& m) {
+    attack_rate.add(m.attack_rate);
+    peak_day.add(m.peak_day);
+    peak_cases.add(m.peak_cases);
+    second_waves += m.second_wave;
+}
+
+double MetricsSummary::second_wave_probability() const {
+    return runs() > 0 ? (double) second_waves / (double) runs() : 0.0;
+}
+
+double MetricsSummary::second_wave_half_width() const {
+    const double n = (double) runs() + 4;
+    const double p = ((double) second_waves + 2) / n;
+    return 1.96 * std::sqrt(p * (1 - p) / n);
+}
+
+bool MetricsSummary::meets(const StoppingRule& rule) const {
+    auto within = [](double half_width, double target) { return target <= 0 || half_width <= target; };
+    return within(1.96 * attack_rate.std_error(), rule.attack_rate)
+           && within(1.96 * peak_day.std_error(), rule.peak_day)
+           && within(1.96 * peak_cases.std_error(), rule.peak_cases)
+           && within(second_wave_half_width(), rule.second_wave);
+}
+
+void DailySummary::add(const std::vector<DayStats>& trajectory) {
+    if (columns_.size() < trajectory.size()) {
+        columns_.resize(trajectory.size());
+        days_.resize(trajectory.size());
+    }
+    for (size_t d = 0; d < trajectory.size(); d++) {
+        const DayStats& row = trajectory[d];
+        days_[d] = row.day;
+        const double values[3] = {(double) row.cases, (double) row.infected, row.avg_susceptibility};
+        for (int c = 0; c < 3; c++) {
+            columns_[d][c].moments.add(values[c]);
+            columns_[d][c].sketch.add(values[c]);
+        }
+    }
+    replicas_++;
+}
+
+void DailySummary::write_header(std::ostream& out, const std::string& key_columns) {
+    out << key_columns;
+    for (const char* column : {"cases", "infected", "avg_susceptibility"}) {
+        out << "," << column << "_mean," << column << "_sd";
+        for (double q : quantiles) {
+            out << "," << column << "_q" << std::setw(2) << std::setfill('0') << (int) std::lround(q * 100)
+                << std::setfill(' ');
+        }
+    }
+    out << "\n";
+}
+
+void DailySummary::write(std::ostream& out, const std::string& key) const {
+    for (size_t d = 0; d < columns_.size(); d++) {
+        out << key << days_[d];
+        for (const Column& column : columns_[d]) {
+            out << "," << column.moments.mean << "," << column.moments.stddev();
+            for (double q : quantiles) {
+                out << "," << column.sketch.quantile(q);
+            }
+        }
+        out << "\n";
+    }
+}
+
+void OrderedSummary::submit(int replica, std::vector<DayStats> trajectory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.emplace(replica, std::move(trajectory));
+    for (auto it = waiting_.begin(); it != waiting_.end() && it->first == next_; it = waiting_.erase(it)) {
+        summary_.add(it->second);
+        next_++;
+    }
+}
+
+struct SimulationRecycler::Entry {
+    config cfg; // the simulation refers to it
+    std::unique_ptr<Simulation> simulation;
+};
+
+SimulationRecycler::SimulationRecycler(Model model, std::shared_ptr<const Kernel> kernel)
+    : model_(std::move(model)), kernel_(std::move(kernel)) {}
+
+SimulationRecycler::~SimulationRecycler() = default;
+
+void SimulationRecycler::run(const config& cfg, const std::vector<uint64_t>& rng_prefix,
+                             const std::function<void(Simulation&)>& body) {
+    std::unique_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty()) {
+            entry = std::move(idle_.back());
+            idle_.pop_back();
+        }
+    }
+    if (entry) {
+        entry->cfg = cfg;
+        entry->simulation->reset(cfg.seed, cfg.stream);
+    } else {
+        entry = std::make_unique<Entry>();
+        entry->cfg = cfg;
+        entry->simulation = std::make_unique<Simulation>(entry->cfg, model_, kernel_);
+    }
+    entry->simulation->set_rng_prefix(rng_prefix);
+    body(*entry->simulation);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(std::move(entry));
+}
+
+std::string replica_file(const std::string& path, int r) {
+    const std::string tag = ".r" + std::to_string(r);
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path + tag;
+    }
+    return path.substr(0, dot) + tag + path.substr(dot);
+}
+
+namespace {
+
+struct Replica {
+    config cfg;
+    std::vector<uint64_t> rng_prefix;
+};
+
+struct ReplicaResult {
+    RunMetrics metrics;
+};
+
+// Runs every replica on the pool. Each Simulation owns its state and each worker its thread_local RNG, which
+// simulate() reseeds from the replica's (seed, stream), so the results are those of a sequential run.
+std::vector<ReplicaResult> run_all(const Model& model, const std::vector<Replica>& replicas,
+                                   const RunOptions& options) {
+    std::vector<ReplicaResult> results(replicas.size());
+    if (replicas.empty()) {
+        return results;
+    }
+    // Replicas differ only in their streams, so they all share one kernel
+    const config& first = replicas.front().cfg;
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, first.inf_length, first.contact_cache_quantum,
+                                                 first.contact_cache_entries);
+    OrderedSummary daily;
+    SimulationRecycler simulations(model, kernel);
+    ThreadPool pool(std::min<int>(options.threads, (int) replicas.size()));
+    pool.parallel_for((int) replicas.size(), [&](int r) {
+        config cfg = replicas[r].cfg;
+        cfg.quiet = true;
+        cfg.output_file = options.output == ReplicaOutput::PerReplica ? replica_file(options.output_file, r) : "";
+        simulations.run(cfg, replicas[r].rng_prefix, [&](Simulation& simulation) {
+            simulation.simulate();
+            results[r].metrics = measure(simulation.get_cases_by_day(), cfg.N);
+            if (options.output == ReplicaOutput::Aggregate) {
+                daily.submit(r, simulation.get_trajectory());
+            }
+        });
+    });
+
+    if (options.output == ReplicaOutput::Aggregate) {
+        std::ofstream out(options.output_file);
+        DailySummary::write_header(out, "day");
+        daily.summary().write(out, "");
+    }
+    return results;
+}
+
+MetricsSummary run_replicas(const config& base, const Model& model, int runs, const RunOptions& options) {
+    std::vector<Replica> replicas;
+    for (int r = 0; r < runs; r++) {
+        config cfg = base;
+        cfg.stream = base.stream + r;
+        replicas.push_back({cfg, {}});
+    }
+    RunOptions metrics_only = options;
+    metrics_only.output = ReplicaOutput::None;
+    MetricsSummary result;
+    for (const ReplicaResult& r : run_all(model, replicas, metrics_only)) {
+        result.add(r.metrics);
+    }
+    return result;
+}
+
+// Largest relative error over a log-uniform scan of [lo, hi] (exp is scanned uniformly).
+template <class Approx, class Exact>
+double scan_error(Approx approx, Exact exact, double lo, double hi, bool log_spaced, double skip_below) {
+    const int n_points = 2000000;
+    double max_err = 0.0;
+    for (int i = 0; i <= n_points; i++) {
+        double f = (double) i / n_points;
+        double x = log_spaced ? std::exp(std::log(lo) + f * (std::log(hi) - std::log(lo))) : lo + f * (hi - lo);
+        double e = exact(x);
+        if (std::fabs(e) < skip_below || e == 0) continue;
+        max_err = std::max(max_err, std::fabs(approx(x) - e) / std::fabs(e));
+    }
+    return max_err;
+}
+
+// Mean time of one call of `f` in nanoseconds, over arguments spread uniformly on [lo, hi].
+template <class F>
+double ns_per_call(F f, double lo, double hi) {
+    std::vector<double> args(4096);
+    for (size_t i = 0; i < args.size(); i++) args[i] = lo + (hi - lo) * ((double) i + 0.5) / (double) args.size();
+    const int rounds = 2000;
+    double sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (double x : args) sink += f(x);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    volatile double keep = sink; // the sums must not be optimized away
+    (void) keep;
+    return 1e9 * seconds / ((double) rounds * (double) args.size());
+}
+
+bool report(std::ostream& out, const char* name, const stats::Welford& precise, const stats::Welford& fast,
+            const char* precise_label = "precise", const char* fast_label = "fast") {
+    const double z_limit = 4.0;
+    double z = stats::welch_z(precise, fast);
+    bool ok = std::fabs(z) < z_limit;
+    out << std::left << std::setw(12) << name << std::right
+        << " " << precise_label << " " << std::setw(12) << precise.mean << " +- " << std::setw(10) << precise.std_error()
+        << "   " << fast_label << " " << std::setw(12) << fast.mean << " +- " << std::setw(10) << fast.std_error()
+        << "   z " << std::setw(7) << z << (ok ? "   ok" : "   MISMATCH") << std::endl;
+    return ok;
+}
+
+} // namespace
+
+void run_design(const config& base, const Model& model, Design design, int runs, int randomizations,
+                const RunOptions& options, std::ostream& out) {
+    if (design == Design::Antithetic && runs % 2 != 0) {
+        throw std::invalid_argument("an antithetic design needs an even number of runs, not " +
+                                    std::to_string(runs));
+    }
+    if (design == Design::Sobol && (randomizations < 1 || runs % randomizations != 0)) {
+        throw std::invalid_argument("a sobol design needs a multiple of its " + std::to_string(randomizations) +
+                                    " randomizations as the number of runs, not " + std::to_string(runs));
+    }
+
+    // Replicas grouped into independent units whose means are i.i.d.
+    std::vector<Replica> replicas;
+    std::vector<int> group_of;
+    const char* name = "monte-carlo";
+    if (design == Design::MonteCarlo) {
+        for (int r = 0; r < runs; r++) {
+            config cfg = base;
+            cfg.stream = base.stream + r;
+            replicas.push_back({cfg, {}});
+            group_of.push_back(r);
+        }
+    } else if (design == Design::Antithetic) {
+        name = "antithetic";
+        for (int p = 0; p < runs / 2; p++) {
+            config cfg = base;
+            cfg.stream = base.stream + p;
+            cfg.antithetic = false;
+            replicas.push_back({cfg, {}});
+            cfg.antithetic = true;
+            replicas.push_back({cfg, {}});
+            group_of.insert(group_of.end(), {p, p});
+        }
+    } else {
+        name = "sobol";
+        const int points = runs / randomizations;
+        const int dims = SobolSequence::max_dimensions;
+        for (int k = 0; k < randomizations; k++) {
+            PhiloxEngine shift_rng(base.seed, substream(base.stream, k));
+            std::vector<uint64_t> shift(dims);
+            for (auto& word : shift) word = shift_rng();
+            SobolSequence sobol(dims, shift);
+            for (int i = 0; i < points; i++) {
+                config cfg = base;
+                cfg.stream = base.stream + (uint64_t) k * points + i;
+                replicas.push_back({cfg, sobol.point(i)});
+                group_of.push_back(k);
+            }
+        }
+    }
+
+    std::vector<ReplicaResult> results = run_all(model, replicas, options);
+    std::vector<std::vector<RunMetrics>> groups(group_of.empty() ? 0 : group_of.back() + 1);
+    for (size_t r = 0; r < results.size(); r++) {
+        groups[group_of[r]].push_back(results[r].metrics);
+    }
+
+    const std::pair<const char*, double (*)(const RunMetrics&)> metrics[] = {
+        {"attack_rate", [](const RunMetrics& m) { return m.attack_rate; }},
+        {"peak_day", [](const RunMetrics& m) { return (double) m.peak_day; }},
+        {"peak_cases", [](const RunMetrics& m) { return (double) m.peak_cases; }},
+        {"second_wave", [](const RunMetrics& m) { return m.second_wave ? 1.0 : 0.0; }},
+    };
+    int total_runs = 0;
+    for (const auto& group : groups) total_runs += (int) group.size();
+    out << name << " design: " << total_runs << " runs in " << groups.size() << " independent groups" << std::endl;
+    for (const auto& [metric, value] : metrics) {
+        stats::Welford all, group_means;
+        for (const auto& group : groups) {
+            stats::Welford g;
+            for (const RunMetrics& m : group) {
+                all.add(value(m));
+                g.add(value(m));
+            }
+            group_means.add(g.mean);
+        }
+        double design_var = group_means.variance() / (double) group_means.n;
+        double mc_var = all.variance() / (double) all.n;
+        out << std::left << std::setw(12) << metric << std::right
+            << " mean " << std::setw(12) << group_means.mean
+            << "   95% +- " << std::setw(10) << 1.96 * std::sqrt(design_var)
+            << "   variance reduction x" << (design_var > 0 ? mc_var / design_var : HUGE_VAL) << std::endl;
+    }
+}
+
+void run_forks(const config& base, const Model& model, double burn_in, int runs, const RunOptions& options,
+               std::ostream& out) {
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, base.inf_length, base.contact_cache_quantum,
+                                                 base.contact_cache_entries);
+    config burn_cfg = base;
+    burn_cfg.output_file = "";
+    burn_cfg.quiet = true;
+    Simulation burn(burn_cfg, model, kernel);
+    burn.start();
+    burn.run_until(burn_in);
+    const Simulation::Snapshot snapshot = burn.snapshot();
+
+    std::vector<RunMetrics> metrics(runs);
+    OrderedSummary daily;
+    ThreadPool pool(std::min(options.threads, std::max(runs, 1)));
+    pool.parallel_for(runs, [&](int k) {
+        config cfg = base;
+        cfg.stream = base.stream + 1 + k;
+        cfg.quiet = true;
+        cfg.output_file = options.output == ReplicaOutput::PerReplica ? replica_file(options.output_file, k) : "";
+        Simulation fork(cfg, model, kernel, snapshot);
+        fork.reseed_rng(cfg.seed, cfg.stream);
+        fork.run_until(cfg.t_max);
+        metrics[k] = measure(fork.get_cases_by_day(), cfg.N);
+        if (options.output == ReplicaOutput::Aggregate) {
+            daily.submit(k, fork.get_trajectory());
+        }
+    });
+
+    MetricsSummary summary;
+    for (const RunMetrics& m : metrics) summary.add(m);
+    out << runs << " forks after a burn-in to t = " << burn_in << std::endl;
+    for (const auto& [name, w] : {std::pair<const char*, const stats::Welford&>{"attack_rate", summary.attack_rate},
+                                  {"peak_day", summary.peak_day},
+                                  {"peak_cases", summary.peak_cases}}) {
+        out << std::left << std::setw(12) << name << std::right << " mean " << std::setw(12) << w.mean
+            << "   95% +- " << std::setw(10) << 1.96 * w.std_error() << std::endl;
+    }
+    out << std::left << std::setw(12) << "second_wave" << std::right << " mean " << std::setw(12)
+        << summary.second_wave_probability() << "   95% +- " << std::setw(10) << summary.second_wave_half_width()
+        << std::endl;
+    if (options.output == ReplicaOutput::Aggregate) {
+        std::ofstream csv(options.output_file);
+        DailySummary::write_header(csv, "day");
+        daily.summary().write(csv, "");
+    }
+}
+
+int validate_fast_math(const config& base, const Model& precise, const Model& fast, int runs,
+                       const RunOptions& options, std::ostream& out) {
+    bool ok = true;
+
+    auto fexp = [](double x) { return epi::fast::exp(x); };
+    auto sexp = [](double x) { return std::exp(x); };
+    auto flog = [](double x) { return epi::fast::log(x); };
+    auto slog = [](double x) { return std::log(x); };
+
+    double exp_err = scan_error(fexp, sexp, -708.0, 709.0, false, 0.0);
+    double log_err = std::max(scan_error(flog, slog, 1e-300, 1e300, true, 1e-3),
+                              scan_error(flog, slog, 1e-12, 1.0, true, 1e-3)); // -log(u) range
+    out << "fast::exp max relative error " << exp_err << " (documented " << epi::fast::exp_max_rel_error << ")"
+        << std::endl;
+    out << "fast::log max relative error " << log_err << " (documented " << epi::fast::log_max_rel_error << ")"
+        << std::endl;
+    ok = ok && exp_err <= epi::fast::exp_max_rel_error && log_err <= epi::fast::log_max_rel_error;
+    out << "ns per call: std::exp " << ns_per_call(sexp, -50.0, 50.0) << ", fast::exp " << ns_per_call(fexp, -50.0, 50.0)
+        << ", std::log " << ns_per_call(slog, 1e-6, 1e3) << ", fast::log " << ns_per_call(flog, 1e-6, 1e3)
+        << std::endl;
+
+    // The modes draw from disjoint streams, so the two ensembles are independent samples
+    auto timed = [&](const config& cfg, const Model& model, double& seconds) {
+        const auto start = std::chrono::steady_clock::now();
+        MetricsSummary summary = run_replicas(cfg, model, runs, options);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return summary;
+    };
+    config fast_base = base;
+    fast_base.stream = base.stream + runs;
+    double precise_seconds = 0, fast_seconds = 0;
+    MetricsSummary precise_summary = timed(base, precise, precise_seconds);
+    MetricsSummary fast_summary = timed(fast_base, fast, fast_seconds);
+
+    out << "ensemble of " << runs << " runs per mode (N = " << base.N << ", t_max = " << base.t_max << ")" << std::endl;
+    ok = report(out, "attack_rate", precise_summary.attack_rate, fast_summary.attack_rate) && ok;
+    ok = report(out, "peak_day", precise_summary.peak_day, fast_summary.peak_day) && ok;
+    ok = report(out, "peak_cases", precise_summary.peak_cases, fast_summary.peak_cases) && ok;
+    out << "wall time: precise " << precise_seconds << " s, fast " << fast_seconds << " s (x"
+        << (fast_seconds > 0 ? precise_seconds / fast_seconds : HUGE_VAL) << ")" << std::endl;
+
+    out << (ok ? "fast-math validation passed" : "fast-math validation FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+int validate_engine(const config& base, const Model& model, Engine engine, int runs, const RunOptions& options,
+                    std::ostream& out) {
+    // Time Warp draws like --crn runs do and so must reproduce them exactly
+    const bool exact = engine == Engine::TimeWarp;
+    config reference = base;
+    reference.crn = base.crn || exact;
+    MetricsSummary sequential = exact ? MetricsSummary{} : run_replicas(reference, model, runs, options);
+
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, base.inf_length, base.contact_cache_quantum,
+                                                 base.contact_cache_entries);
+    MetricsSummary parallel;
+    int identical = 0;
+    std::ostringstream details;
+    long delayed = 0, events = 0;
+    TimeWarpSimulation::Counters warp;
+    RelaxedSimulation::RankError rank;
+    double rank_sum = 0;
+    for (int r = 0; r < runs; r++) {
+        config cfg = reference;
+        cfg.stream = base.stream + r;
+        cfg.quiet = true;
+        cfg.output_file = "";
+        if (engine == Engine::Conservative) {
+            ParallelSimulation simulation(cfg, model, kernel, options.threads);
+            simulation.simulate();
+            parallel.add(measure(simulation.get_cases_by_day(), cfg.N));
+            delayed += simulation.delayed_contacts();
+            events += simulation.events_processed();
+            details.str("");
+            details << "lookahead " << simulation.lookahead() << ", " << delayed << " of " << events
+                    << " events delayed";
+        } else if (engine == Engine::MultiQueue) {
+            RelaxedSimulation simulation(cfg, model, kernel, options.threads);
+            simulation.sample_rank_error(1024);
+            simulation.simulate();
+            parallel.add(measure(simulation.get_cases_by_day(), cfg.N));
+            RelaxedSimulation::RankError r_error = simulation.rank_error();
+            rank.samples += r_error.samples;
+            rank_sum += r_error.mean * (double) r_error.samples;
+            rank.max = std::max(rank.max, r_error.max);
+            rank.mean = rank.samples > 0 ? rank_sum / (double) rank.samples : 0;
+            details.str("");
+            details << RelaxedSimulation::default_heaps_per_thread * options.threads << " heaps, rank error mean "
+                    << rank.mean << " max " << rank.max << " over " << rank.samples << " sampled pops";
+        } else {
+            TimeWarpSimulation simulation(cfg, model, kernel, options.threads);
+            simulation.simulate();
+            Simulation check(cfg, model, kernel);
+            check.simulate();
+            parallel.add(measure(simulation.get_cases_by_day(), cfg.N));
+            sequential.add(measure(check.get_cases_by_day(), cfg.N));
+            if (simulation.get_cases_by_day() == check.get_cases_by_day()) {
+                identical++;
+            }
+            TimeWarpSimulation::Counters c = simulation.counters();
+            warp.events_processed += c.events_processed;
+            warp.events_rolled_back += c.events_rolled_back;
+            warp.anti_messages += c.anti_messages;
+            warp.rounds += c.rounds;
+            warp.max_saved_events = std::max(warp.max_saved_events, c.max_saved_events);
+            details.str("");
+            details << warp.events_processed << " events processed, " << warp.events_rolled_back << " rolled back, "
+                    << warp.anti_messages << " anti-messages, " << warp.rounds << " rounds, at most "
+                    << warp.max_saved_events << " saved events per partition";
+        }
+    }
+
+    bool ok = true;
+    out << "ensemble of " << runs << " runs per engine (N = " << base.N << ", t_max = " << base.t_max
+        << ", " << options.threads << " threads, " << details.str() << ")" << std::endl;
+    ok = report(out, "attack_rate", sequential.attack_rate, parallel.attack_rate, "sequential", "parallel") && ok;
+    ok = report(out, "peak_day", sequential.peak_day, parallel.peak_day, "sequential", "parallel") && ok;
+    ok = report(out, "peak_cases", sequential.peak_cases, parallel.peak_cases, "sequential", "parallel") && ok;
+    if (exact) {
+        out << identical << " of " << runs << " runs identical to the sequential --crn run" << std::endl;
+        ok = ok && identical == runs;
+    }
+
+    out << (ok ? "engine validation passed" : "engine validation FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+int check_determinism(const config& base, const Model& model, std::ostream& out) {
+    constexpr int thread_counts[] = {1, 4, 32};
+    constexpr int runs = 8;
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, base.inf_length, base.contact_cache_quantum,
+                                                 base.contact_cache_entries);
+    // A name of its own, so that concurrent checks do not overwrite each other's aggregate files
+    const std::string csv = (std::filesystem::temp_directory_path()
+                             / ("epinetcpp2-determinism-" + std::to_string(random_seed()) + ".csv"))
+                                .string();
+    config cfg = base;
+    cfg.quiet = true;
+    cfg.output_file = "";
+
+    auto rows = [](const std::vector<DayStats>& trajectory) {
+        std::ostringstream text;
+        for (const DayStats& row : trajectory) {
+            Simulation::write_row(text, row);
+        }
+        return text.str();
+    };
+    // Report and aggregate CSV of an ensemble mode
+    auto ensemble = [&](int threads, const std::function<void(const RunOptions&, std::ostream&)>& mode) {
+        RunOptions options{.threads = threads, .output = ReplicaOutput::Aggregate, .output_file = csv};
+        std::ostringstream text;
+        mode(options, text);
+        std::ifstream in(csv);
+        text << in.rdbuf();
+        in.close();
+        std::remove(csv.c_str());
+        return text.str();
+    };
+    sweep::Grid fixed = {base.beta * 0.9, base.beta, base.beta * 0.1, runs / 2, {}};
+    sweep::Grid adaptive = fixed;
+    adaptive.stopping = {.attack_rate = 1e-3, .min_runs = runs / 2, .max_runs = runs};
+
+    const std::pair<const char*, std::function<std::string(int)>> checks[] = {
+        {"conservative", [&](int threads) {
+             ParallelSimulation simulation(cfg, model, kernel, threads);
+             simulation.simulate();
+             return rows(simulation.get_trajectory());
+         }},
+        {"timewarp", [&](int threads) {
+             TimeWarpSimulation simulation(cfg, model, kernel, threads);
+             simulation.simulate();
+             return rows(simulation.get_trajectory());
+         }},
+        {"daystep", [&](int threads) {
+             DayStepSimulation simulation(cfg, model, threads);
+             simulation.simulate();
+             return rows(simulation.get_trajectory());
+         }},
+        {"monte-carlo", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 run_design(cfg, model, Design::MonteCarlo, runs, 1, o, text);
+             });
+         }},
+        {"antithetic", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 run_design(cfg, model, Design::Antithetic, runs, 1, o, text);
+             });
+         }},
+        {"sobol", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 run_design(cfg, model, Design::Sobol, runs, 2, o, text);
+             });
+         }},
+        {"forks", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 run_forks(cfg, model, std::max(1.0, cfg.t_max / 4), runs, o, text);
+             });
+         }},
+        {"sweep", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 sweep::run(cfg, model, fixed, o, text);
+             });
+         }},
+        {"adaptive sweep", [&](int threads) {
+             return ensemble(threads, [&](const RunOptions& o, std::ostream& text) {
+                 sweep::run(cfg, model, adaptive, o, text);
+             });
+         }},
+    };
+
+    bool ok = true;
+    out << "determinism check (N = " << base.N << ", t_max = " << base.t_max << ", seed " << base.seed
+        << ", stream " << base.stream << ") on 1, 4 and 32 threads" << std::endl;
+    for (const auto& [name, run] : checks) {
+        const std::string reference = run(thread_counts[0]);
+        std::string differs;
+        for (int threads : thread_counts) {
+            if (threads != thread_counts[0] && run(threads) != reference) {
+                differs += " " + std::to_string(threads);
+            }
+        }
+        out << std::left << std::setw(16) << name << std::right
+            << (differs.empty() ? "identical" : "DIFFERS on" + differs + " threads") << std::endl;
+        ok = ok && differs.empty();
+    }
+    out << (ok ? "determinism check passed" : "determinism check FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+} // namespace epi::ensemble
@@ -0,0 +1,201 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "stats.h"
+
+class Simulation;
+
+namespace epi {
+class Kernel;
+}
+
+namespace epi::ensemble {
+
+/// Scalar outcomes of one replica used to compare ensembles.
+struct RunMetrics {
+    double attack_rate; // total cases per capita (reinfections included)
+    int peak_day;
+    int peak_cases;
+    bool second_wave; // weekly-averaged cases fell below a quarter of their peak, then rose above half of it again
+};
+
+RunMetrics measure(const std::vector<int>& cases_by_day, int population);
+
+/// Precision targets of an adaptive ensemble: 95% half-widths per metric (0: no target). A point stops at the
+/// first replica count n >= min_runs whose replicas 0..n-1 meet every target, or at max_runs.
+struct StoppingRule {
+    double attack_rate = 0;
+    double peak_day = 0;
+    double peak_cases = 0;
+    double second_wave = 0; // of the probability of a second wave
+    int min_runs = 20;
+    int max_runs = 1000;
+
+    [[nodiscard]] bool active() const {
+        return attack_rate > 0 || peak_day > 0 || peak_cases > 0 || second_wave > 0;
+    }
+};
+
+/// Running statistics of RunMetrics over a set of replicas.
+struct MetricsSummary {
+    stats::Welford attack_rate, peak_day, peak_cases;
+    int64_t second_waves = 0;
+
+    void add(const RunMetrics& m);
+
+    [[nodiscard]] int64_t runs() const { return attack_rate.n; }
+    [[nodiscard]] double second_wave_probability() const;
+    /// 95% half-width of the second wave probability (Agresti-Coull, so it is not 0 before the first wave is seen).
+    [[nodiscard]] double second_wave_half_width() const;
+    [[nodiscard]] bool meets(const StoppingRule& rule) const;
+};
+
+/// Online per-day aggregate of replica trajectories: mean, standard deviation and quantiles (KLL sketches) of
+/// the cases, infected and avg_susceptibility columns. Replicas are folded in as they finish, so memory does not
+/// grow with the number of runs.
+class DailySummary {
+public:
+    static constexpr std::array<double, 5> quantiles = {0.05, 0.25, 0.5, 0.75, 0.95};
+
+    void add(const std::vector<DayStats>& trajectory);
+
+    /// Header of the summary CSV: `key_columns` (e.g. "day" or "beta,day") then
+    /// <column>_mean,<column>_sd,<column>_q05,... for each output column.
+    static void write_header(std::ostream& out, const std::string& key_columns);
+
+    /// One row per day, each prefixed with `key` (e.g. "0.75," in a sweep; may be empty).
+    void write(std::ostream& out, const std::string& key) const;
+
+    [[nodiscard]] int replicas() const { return replicas_; }
+
+private:
+    struct Column {
+        stats::Welford moments;
+        stats::KllSketch sketch;
+    };
+
+    std::vector<int> days_;
+    std::vector<std::array<Column, 3>> columns_; // per day: cases, infected, avg_susceptibility
+    int replicas_ = 0;
+};
+
+/// Folds trajectories into a DailySummary in replica order whatever order they finish in, holding back only the
+/// ones that finished early, so the summary does not depend on the thread count. Thread-safe.
+class OrderedSummary {
+public:
+    explicit OrderedSummary(int first_replica = 0) : next_(first_replica) {}
+
+    void submit(int replica, std::vector<DayStats> trajectory);
+
+    /// Call after all submitted replicas have finished.
+    [[nodiscard]] const DailySummary& summary() const { return summary_; }
+
+private:
+    std::mutex mutex_;
+    std::map<int, std::vector<DayStats>> waiting_;
+    int next_;
+    DailySummary summary_;
+};
+
+/// Simulations kept for reuse by the replicas of an ensemble. Each replica takes an idle one and resets it in
+/// place (Simulation::reset), so after the first replica on each thread replicas allocate nothing. All configs
+/// passed in must have the infection length the kernel was built for. Thread-safe.
+class SimulationRecycler {
+public:
+    SimulationRecycler(Model model, std::shared_ptr<const Kernel> kernel);
+    ~SimulationRecycler();
+
+    SimulationRecycler(const SimulationRecycler&) = delete;
+    SimulationRecycler& operator=(const SimulationRecycler&) = delete;
+
+    /// Calls body with a simulation set up for `cfg` and `rng_prefix`, not yet started.
+    void run(const config& cfg, const std::vector<uint64_t>& rng_prefix,
+             const std::function<void(Simulation&)>& body);
+
+private:
+    struct Entry;
+
+    Model model_;
+    std::shared_ptr<const Kernel> kernel_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Entry>> idle_;
+};
+
+/// Where the daily rows of an ensemble's replicas go.
+enum class ReplicaOutput {
+    None,
+    PerReplica, // each replica writes its own CSV, see replica_file()
+    Aggregate,  // one DailySummary CSV over all replicas
+};
+
+/// Output file of replica `r`: "out.csv" becomes "out.r<r>.csv".
+std::string replica_file(const std::string& path, int r);
+
+/// Ensemble execution settings shared by all modes.
+struct RunOptions {
+    int threads = 1;
+    ReplicaOutput output = ReplicaOutput::None;
+    std::string output_file; // base name for PerReplica and Aggregate
+    bool longest_first = false; // sweeps: start the points a pilot run estimates most expensive first
+};
+
+/// Checks the fast-math kernels: scans the approximation error of epi::fast::exp/log against the
+/// documented bounds, then runs `runs` replicas of `precise` (streams base.stream, base.stream + 1, ...) and
+/// `runs` of `fast` on the next, independent streams, and compares the ensemble means of RunMetrics with a
+/// two-sample test. Reports the wall time of both ensembles. Returns 0 when everything is within tolerance.
+int validate_fast_math(const config& base, const Model& precise, const Model& fast, int runs,
+                       const RunOptions& options, std::ostream& out);
+
+/// Engines of a single run.
+enum class Engine {
+    Sequential,   // Simulation
+    Conservative, // ParallelSimulation
+    TimeWarp,     // TimeWarpSimulation
+    DayStep,      // DayStepSimulation (a different model formulation)
+    MultiQueue,   // RelaxedSimulation (approximate event order)
+};
+
+/// Checks a parallel engine against the sequential one: runs `runs` replicas of each (streams base.stream,
+/// base.stream + 1, ...), the parallel ones one after another on options.threads partitions, and compares the
+/// ensemble means of RunMetrics. TimeWarp runs must moreover reproduce the sequential --crn runs exactly;
+/// for MultiQueue the rank error of its pops is reported as well.
+/// Returns 0 when they agree.
+int validate_engine(const config& base, const Model& model, Engine engine, int runs, const RunOptions& options,
+                    std::ostream& out);
+
+/// Checks that results do not depend on the thread count: runs the conservative, Time Warp and day-step engines
+/// and every ensemble mode (the three designs, forks after a burn-in to t_max / 4, a fixed and an adaptive beta
+/// sweep) on 1, 4 and 32 threads and compares their rows, aggregate CSVs and reports byte for byte.
+/// The multiqueue engine is approximate by design and not checked. Returns 0 when all are identical.
+int check_determinism(const config& base, const Model& model, std::ostream& out);
+
+/// How the replicas of an ensemble are driven.
+enum class Design {
+    MonteCarlo, // independent streams
+    Antithetic, // pairs of one stream, the second with every random word complemented
+    Sobol,      // the first random words of each replica are a digitally shifted Sobol point
+};
+
+/// Runs `runs` replicas under `design` and reports for each metric the ensemble mean, its 95% half-width and the
+/// variance reduction achieved, i.e. the plain Monte Carlo variance of the mean at the same number of runs divided
+/// by the design's. The error is estimated from independent groups: pairs for Antithetic, `randomizations`
+/// independently shifted point sets for Sobol, single runs for MonteCarlo. Throws std::invalid_argument unless
+/// every group is complete: `runs` must be even for Antithetic and a multiple of `randomizations` for Sobol.
+/// Replicas run concurrently on `options.threads` threads; results do not depend on the thread count.
+void run_design(const config& base, const Model& model, Design design, int runs, int randomizations,
+                const RunOptions& options, std::ostream& out);
+
+/// Runs one simulation to `burn_in`, snapshots it and continues `runs` forks of the snapshot to t_max, fork k on
+/// stream base.stream + 1 + k. The burn-in is simulated once; forks share its node blocks copy-on-write. Reports the
+/// metrics of the forks like run_design and writes their output as set in `options`.
+void run_forks(const config& base, const Model& model, double burn_in, int runs, const RunOptions& options,
+               std::ostream& out);
+
+} // namespace epi::ensemble
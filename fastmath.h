@@ -0,0 +1,145 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Polynomial (exp) and table-driven (log) approximations for the simulation kernels.
+//
+// Both are branch-light, inline and allocation-free so they can be inlined into the hot loops
+// (susceptibility curves, logn, Poisson counts, sampler slow paths), and faster than the libm calls.
+// Accuracy is checked by `epinetcpp2 --validate-fast-math`, which scans the full double range
+// and compares ensemble outputs of the precise and fast modes.
+
+namespace epi::fast {
+
+/// Documented maximum relative error of epi::fast::exp over [-708, 709].
+constexpr double exp_max_rel_error = 5e-10;
+
+/// Documented maximum relative error of epi::fast::log over (0, +inf) away from x = 1
+/// (absolute error below 1e-15 in the neighbourhood of 1, where log(x) itself vanishes).
+constexpr double log_max_rel_error = 1e-10;
+
+/// exp(x) via range reduction x = k ln2 + r, |r| <= ln2/2, with k rounded by the 1.5 * 2^52 shift (no floor call),
+/// and a degree-8 Taylor polynomial in r evaluated in Estrin form.
+inline double exp(double x) {
+    if (!(x >= -708.0 && x <= 709.0)) {
+        return x != x ? x : x > 0 ? HUGE_VAL : 0.0;
+    }
+
+    constexpr double shift = 0x1.8p52;
+    constexpr double ln2_hi = 6.93147180369123816490e-01;
+    constexpr double ln2_lo = 1.90821492927058770002e-10;
+    const double kd = x * 1.44269504088896338700 + shift;
+    uint64_t ki; // k in its low bits
+    std::memcpy(&ki, &kd, sizeof(ki));
+    const double k = kd - shift;
+    const double r = (x - k * ln2_hi) - k * ln2_lo;
+
+    const double r2 = r * r, r4 = r2 * r2;
+    const double p01 = 1.0 + r, p23 = 0.5 + r * (1.0 / 6.0);
+    const double p45 = 1.0 / 24.0 + r * (1.0 / 120.0), p67 = 1.0 / 720.0 + r * (1.0 / 5040.0);
+    const double p = (p01 + r2 * p23) + r4 * ((p45 + r2 * p67) + r4 * (1.0 / 40320.0));
+
+    const uint64_t bits = (ki + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+namespace detail {
+
+/// log(c) and 1/c at the centres c of 128 equal subintervals of [1, 2), with log(c) = -log(1/c) exactly for the
+/// rounded 1/c. Computed at compile time from the atanh series.
+struct LogTable {
+    static constexpr int bits = 7;
+    double inv_c[1 << bits];
+    double log_c[1 << bits];
+};
+
+constexpr double series_log(double x) {
+    const double s = (x - 1) / (x + 1), s2 = s * s;
+    double term = s, sum = 0;
+    for (int n = 1; n < 60; n += 2) {
+        sum += term / n;
+        term *= s2;
+    }
+    return 2 * sum;
+}
+
+constexpr LogTable make_log_table() {
+    LogTable table{};
+    for (int i = 0; i < (1 << LogTable::bits); i++) {
+        table.inv_c[i] = 1.0 / (1.0 + (i + 0.5) / (1 << LogTable::bits));
+        table.log_c[i] = -series_log(table.inv_c[i]);
+    }
+    return table;
+}
+
+inline constexpr LogTable log_table = make_log_table();
+
+} // namespace detail
+
+/// log(x) via x = m 2^e, m in [1, 2), and log(m) = log(c) + log(1 + r) with r = m/c - 1, |r| < 2^-8, for the
+/// nearest tabulated c: a degree-5 series in r, no division.
+inline double log(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    int e = 0;
+    if (bits - 0x0010000000000000ULL >= 0x7fe0000000000000ULL) { // zero, subnormal, negative, inf or nan
+        if (x == 0) return -HUGE_VAL;
+        if (!(x > 0)) return NAN;
+        if (x == HUGE_VAL) return x;
+        x *= 18014398509481984.0; // subnormal: renormalize through a 2^54 scale
+        std::memcpy(&bits, &x, sizeof(bits));
+        e = -54;
+    }
+    e += (int) (bits >> 52) - 1023;
+    const int i = (int) (bits >> (52 - detail::LogTable::bits)) & ((1 << detail::LogTable::bits) - 1);
+    bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+
+    const double r = m * detail::log_table.inv_c[i] - 1.0;
+    const double r2 = r * r;
+    const double p = r + r2 * ((-0.5 + r * (1.0 / 3.0)) + r2 * (-0.25 + r * 0.2));
+
+    constexpr double ln2 = 6.93147180559945309417e-01;
+    return (e * ln2 + detail::log_table.log_c[i]) + p;
+}
+
+} // namespace epi::fast
+
+namespace epi::math {
+
+/// The two implementations as types, for kernels instantiated once per mode (the model curves of infection.h):
+/// the mode is chosen when the model is built, not on every call.
+struct Precise {
+    static double exp(double x) { return std::exp(x); }
+    static double log(double x) { return std::log(x); }
+};
+
+struct Fast {
+    static double exp(double x) { return epi::fast::exp(x); }
+    static double log(double x) { return epi::fast::log(x); }
+};
+
+#ifdef EPI_FAST_MATH
+constexpr bool fast_by_default = true;
+using Default = Fast;
+#else
+constexpr bool fast_by_default = false;
+using Default = Precise;
+#endif
+
+/// exp of the code not instantiated per mode (the samplers' rare paths, Poisson counts): the build's default,
+/// std::exp unless configured with EPI_FAST_MATH.
+inline double exp(double x) {
+    return Default::exp(x);
+}
+
+/// log of the code not instantiated per mode, as exp.
+inline double log(double x) {
+    return Default::log(x);
+}
+
+} // namespace epi::math
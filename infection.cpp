@@ -1,6 +1,9 @@
 #include "infection.h"
 #include "util.h" // For epi::logn and epi::uniform (though uniform not directly used here, logn is)
-#include <cmath>   // For std::exp, HUGE_VAL
+#include <cmath>   // For HUGE_VAL
+#include "fastmath.h" // For epi::math::Precise, epi::math::Fast
+#include "sampling.h" // For epi::EmpiricalProfile, epi::RecoverySampler and its samplers
+#include <memory>
 
 namespace epi::infect {
 
@@ -11,19 +14,22 @@ std::function<double(double)> create_const_infectivity_function(double beta) {
     return func;
 }
 
-std::function<double(double)> create_lognormal_infectivity_function(double scale, double mean, double k) {
-    auto func = [scale, mean, k](double tau) {
-        return epi::logn(tau, scale, mean, k);
+namespace {
+
+template <class Math>
+std::function<double(double)> lognormal_infectivity(double scale, double mean, double k) {
+    return [scale, mean, k](double tau) {
+        return epi::logn<Math>(tau, scale, mean, k);
     };
-    return func;
 }
 
-std::function<double(double)> create_sigmoid_susceptibility_function(double k, double l, double x0) {
+template <class Math>
+std::function<double(double)> sigmoid_susceptibility(double k, double l, double x0) {
     return [k, l, x0](double tau) {
         if (tau < 0) {
             return 0.0;
         } else {
-            double ex = std::exp(-k * (tau - x0));
+            double ex = Math::exp(-k * (tau - x0));
             // Check for overflow before division
             if (ex == HUGE_VAL) return 1.0;
             return 1.0 - l / (1.0 + ex);
@@ -31,23 +37,65 @@ std::function<double(double)> create_sigmoid_susceptibility_function(double k, d
     };
 }
 
-std::function<double(double)> create_poisson_recovery_function(double recovery_length_expectation) {
-    return [recovery_length_expectation](double tau) {
-        double u = epi::uniform();
-        return -std::log(u) / (1 / recovery_length_expectation);
+template <class Math>
+std::function<double(double)> exp_susceptibility(double time_to_immunity) {
+    return [time_to_immunity](double tau) {
+        return 1 - Math::exp(-tau / time_to_immunity);
     };
 }
 
-std::function<double(double)> create_const_recovery_function(double recovery_length) {
-    return [recovery_length](double /*tau*/) {
-        return recovery_length;
+} // namespace
+
+std::function<double(double)> create_lognormal_infectivity_function(double scale, double mean, double k,
+                                                                    bool fast_math) {
+    return fast_math ? lognormal_infectivity<math::Fast>(scale, mean, k)
+                     : lognormal_infectivity<math::Precise>(scale, mean, k);
+}
+
+std::function<double(double)> create_empirical_infectivity_function(const std::string& path) {
+    auto profile = std::make_shared<const EmpiricalProfile>(EmpiricalProfile::load_csv(path));
+    return [profile](double tau) {
+        return (*profile)(tau);
     };
 }
 
-std::function<double(double)> create_exp_susceptibility_function(double time_to_immunity) {
-    return [time_to_immunity](double tau) {
-        return 1 - std::exp(-tau / time_to_immunity);
+InfectivityProfile create_empirical_infectivity_profile(const std::string& path) {
+    auto profile = std::make_shared<const EmpiricalProfile>(EmpiricalProfile::load_csv(path));
+    return {
+        .max_function_value = profile->max_value(),
+        .infectivity_function = [profile](double tau) { return (*profile)(tau); },
+        .sampler = [profile]() {
+            double u_segment = epi::uniform();
+            return profile->sample(u_segment, epi::uniform());
+        },
+        .support_integral = profile->integral()
     };
-};
+}
+
+std::function<double(double)> create_sigmoid_susceptibility_function(double k, double l, double x0,
+                                                                    bool fast_math) {
+    return fast_math ? sigmoid_susceptibility<math::Fast>(k, l, x0) : sigmoid_susceptibility<math::Precise>(k, l, x0);
+}
+
+RecoverySampler create_poisson_recovery_function(double recovery_length_expectation) {
+    return RecoverySampler::Exponential{recovery_length_expectation};
+}
+
+RecoverySampler create_gamma_recovery_function(double recovery_length_expectation, double shape) {
+    return GammaSampler(shape, recovery_length_expectation / shape);
+}
+
+RecoverySampler create_erlang_recovery_function(double recovery_length_expectation, int k) {
+    return ErlangSampler(k, recovery_length_expectation / k);
+}
+
+RecoverySampler create_const_recovery_function(double recovery_length) {
+    return RecoverySampler::Constant{recovery_length};
+}
+
+std::function<double(double)> create_exp_susceptibility_function(double time_to_immunity, bool fast_math) {
+    return fast_math ? exp_susceptibility<math::Fast>(time_to_immunity)
+                     : exp_susceptibility<math::Precise>(time_to_immunity);
+}
 
 } // namespace epi::infect
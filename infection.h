@@ -1,23 +1,43 @@
 #pragma once
 #include "Common.h" // For config, InfectivityProfile
+#include "fastmath.h"
+#include "sampling.h" // For epi::RecoverySampler
 #include <functional> // For std::function
+#include <string>
 
 namespace epi::infect {
 
 /// Creates an InfectivityProfile for a constant infectivity model.
 std::function<double(double)> create_const_infectivity_function(double beta);
 
-/// Creates an InfectivityProfile for a log-normal infectivity model.
-std::function<double(double)> create_lognormal_infectivity_function(double scale, double mean, double k);
+/// Creates an InfectivityProfile for a log-normal infectivity model. The curves below evaluate their exp/log
+/// with epi::fast when `fast_math` is set (instantiated for the mode here, so calls do not branch on it).
+std::function<double(double)> create_lognormal_infectivity_function(double scale, double mean, double k,
+                                                                    bool fast_math = math::fast_by_default);
+
+/// Creates an infectivity function interpolating a tabulated "tau,value" CSV curve.
+std::function<double(double)> create_empirical_infectivity_function(const std::string& path);
+
+/// Creates an InfectivityProfile for a tabulated "tau,value" CSV curve, with an alias-table sampler
+/// so that contact times cost O(1) each regardless of the curve's shape.
+InfectivityProfile create_empirical_infectivity_profile(const std::string& path);
 
 /// Creates a susceptibility function based on a sigmoid-like curve.
-std::function<double(double)> create_sigmoid_susceptibility_function(double k, double l, double x0);
+std::function<double(double)> create_sigmoid_susceptibility_function(double k, double l, double x0,
+                                                                    bool fast_math = math::fast_by_default);
 
 /// Create an exponential immunity decay susceptibility
-std::function<double(double)> create_exp_susceptibility_function(double time_to_immunity);
+std::function<double(double)> create_exp_susceptibility_function(double time_to_immunity,
+                                                                bool fast_math = math::fast_by_default);
+
+RecoverySampler create_poisson_recovery_function(double recovery_length_expectation);
+
+/// Gamma-distributed recovery time with the given mean and shape (Marsaglia-Tsang sampler).
+RecoverySampler create_gamma_recovery_function(double recovery_length_expectation, double shape);
 
-std::function<double(double)> create_poisson_recovery_function(double recovery_length_expectation);
+/// Erlang-distributed recovery time with the given mean and integer shape k (sum of k exponential stages).
+RecoverySampler create_erlang_recovery_function(double recovery_length_expectation, int k);
 
-std::function<double(double)> create_const_recovery_function(double recovery_length);
+RecoverySampler create_const_recovery_function(double recovery_length);
 
 } // namespace epi::infect
@@ -1,8 +1,31 @@
+#include <cmath>
+#include <optional>
 #include "Simulation.h"
+#include "ParallelSimulation.h"
+#include "TimeWarpSimulation.h"
+#include "DayStepSimulation.h"
+#include "RelaxedSimulation.h"
 #include "include/CLI11.hpp"
 #include "infection.h" // Include the header for factory functions
+#include "ensemble.h"
+#include "sweep.h"
+#include "checkpoint.h"
+#include "fastmath.h"
+#include "bench.h"
+#ifdef EPI_MPI
+#include "DistributedSimulation.h"
+#endif
 
 int main(int argc, char **argv) {
+#ifdef EPI_MPI
+    epi::MpiSession mpi(argc, argv);
+    const bool root = epi::MpiSession::rank() == 0;
+    std::vector<std::string> engines = {"sequential", "conservative", "timewarp", "daystep", "multiqueue",
+                                        "distributed"};
+#else
+    const bool root = true;
+    std::vector<std::string> engines = {"sequential", "conservative", "timewarp", "daystep", "multiqueue"};
+#endif
     int conf_N = 100000;
     double conf_t_max = 365 * 2;
     double conf_beta = 1.0;
@@ -18,18 +41,43 @@ int main(int argc, char **argv) {
     double conf_sp_lambda = 0.00;
     double conf_susc_initial = 0.7;
     int conf_n_initial = 1;
+    uint64_t conf_seed = 0;
+    uint64_t conf_stream = 0;
+    bool conf_fast_math = epi::math::fast_by_default;
+    int conf_validate_runs = 0;
+    long conf_bench_messages = 0;
+    bool conf_check_determinism = false;
+    int conf_validate_engine_runs = 0;
+    std::string conf_engine = "sequential";
+    int conf_replicas = 0;
+    int conf_threads = 1;
+    std::string conf_replica_output = "aggregate";
+    std::string conf_sweep_file;
+    bool conf_longest_first = false;
+    double conf_burn_in = 0;
+    double conf_checkpoint_every = 0;
+    std::string conf_checkpoint_file = "checkpoint.bin";
+    std::string conf_resume_file;
+    epi::ensemble::StoppingRule conf_stopping;
+    std::string conf_design = "mc";
+    int conf_randomizations = 8;
+    std::string conf_infectivity_file;
+    double conf_cache_quantum = 0;
+    int conf_cache_entries = 4096;
+    std::string conf_recovery = "const";
+    std::string conf_susceptibility = "sigmoid";
+    double conf_rec_shape = 4;
 
     std::string conf_output_file = "out.csv";
 
     CLI::App app("EpiNet2 stochastic epidemic simulator");
-    app.add_option("-N,--num-people", conf_N,
-                   "Number of people in the population")
-       ->required();
+    auto *n_option = app.add_option("-N,--num-people", conf_N,
+                                    "Number of people in the population (required unless --sweep)");
     app.add_option("-n,--n-initial", conf_n_initial,
                    "Number of initially infected people");
-    app.add_option("-t,--time", conf_t_max, "Simulation time")->required();
-    app.add_option("-b,--beta", conf_beta, "Beta: infectiousness modifier")
-       ->required();
+    auto *t_option = app.add_option("-t,--time", conf_t_max, "Simulation time (required unless --sweep)");
+    auto *beta_option = app.add_option("-b,--beta", conf_beta,
+                                       "Beta: infectiousness modifier (required unless --sweep)");
     app.add_option("-f,--output-file", conf_output_file, "Output file name");
     app.add_option("-i,--infection-length", conf_inf_length,
                    "Disease infection interval cutoff");
@@ -45,17 +93,126 @@ int main(int argc, char **argv) {
                    "Infectiousness curve: mean time");
     app.add_option("-K,--k-infectiousness", conf_inf_k,
                    "Infectiousness curve: shape parameter");
+    app.add_option("--infectivity-file", conf_infectivity_file,
+                   "Tabulated infectivity profile (CSV of tau,value); replaces the log-normal curve")
+       ->check(CLI::ExistingFile);
+    app.add_option("--recovery", conf_recovery,
+                   "Recovery time distribution: const (infection length), poisson, gamma or erlang")
+       ->check(CLI::IsMember({"const", "poisson", "gamma", "erlang"}));
+    app.add_option("--recovery-mean", conf_rec_length, "Mean recovery time of random recovery distributions");
+    app.add_option("--recovery-shape", conf_rec_shape, "Shape of gamma (or integer stages of erlang) recovery")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--contact-cache-quantum", conf_cache_quantum,
+                   "Random recovery lengths: tabulate the contact-time distribution on a grid of this many days (0: off)");
+    app.add_option("--contact-cache-entries", conf_cache_entries,
+                   "Grid cells of the contact-time table; longer recovery lengths fall back to thinning")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--susceptibility", conf_susceptibility,
+                   "Susceptibility after recovery: sigmoid (-k, -l, -x) or exp (1 - exp(-tau / immunity time))")
+       ->check(CLI::IsMember({"sigmoid", "exp"}));
+    app.add_option("--immunity-time", conf_time_to_imm, "Time scale of exp susceptibility");
     app.add_option("-L,--lambda-spontaneous", conf_sp_lambda,
                    "Spontaneous infection rate");
     app.add_option("-S,--susc-initial", conf_susc_initial,
                    "Initial susceptibility (0.0 to 1.0)");
 
+    auto *seed_option = app.add_option("--seed", conf_seed, "RNG seed (random if omitted)");
+    app.add_option("--stream", conf_stream, "RNG stream id: runs with the same seed and stream are identical");
+    app.add_flag("--crn", "Common random numbers: couple runs of the same seed/stream across parameters");
+    app.add_flag("--fast-math,!--precise-math", conf_fast_math,
+                 "Build the model curves with the epi::fast exp/log approximations");
+    app.add_option("--replicas", conf_replicas, "Run an ensemble of this many replicas and report its means");
+    app.add_option("--threads", conf_threads,
+                   "Worker threads running the replicas of an ensemble, or the partitions of a parallel single run")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--replica-output", conf_replica_output,
+                   "Ensemble CSV output: aggregate (per-day means to the output file), per-replica "
+                   "(out.r<i>.csv for each replica) or none")
+       ->check(CLI::IsMember({"aggregate", "per-replica", "none"}));
+    app.add_option("--design", conf_design,
+                   "Ensemble design: mc (independent streams), antithetic (pairs) or sobol (randomized QMC)")
+       ->check(CLI::IsMember({"mc", "antithetic", "sobol"}));
+    app.add_option("--randomizations", conf_randomizations,
+                   "Independent digital shifts of the Sobol design (error estimate)")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--burn-in", conf_burn_in,
+                   "With --replicas: simulate up to this time once, then fork the replicas from a snapshot")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--checkpoint-every", conf_checkpoint_every,
+                   "Write a checkpoint of a single run every this many days (written in the background)")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--checkpoint-file", conf_checkpoint_file, "Checkpoint file name");
+    app.add_option("--resume", conf_resume_file,
+                   "Continue a single run from a checkpoint (its parameters replace the command line's, except -t; "
+                   "the recovery, susceptibility, infectivity and math options must match it)")
+       ->check(CLI::ExistingFile);
+    app.add_option("--sweep", conf_sweep_file,
+                   "Run the parameter grid x runs of a sweep file (config.ini format) in this process")
+       ->check(CLI::ExistingFile);
+    app.add_option("--target-attack-rate", conf_stopping.attack_rate,
+                   "Adaptive sweeps: run each point until the 95% half-width of the attack rate is below this");
+    app.add_option("--target-peak-day", conf_stopping.peak_day, "Adaptive sweeps: target half-width of the peak day");
+    app.add_option("--target-peak-cases", conf_stopping.peak_cases,
+                   "Adaptive sweeps: target half-width of the peak daily cases");
+    app.add_option("--target-second-wave", conf_stopping.second_wave,
+                   "Adaptive sweeps: target half-width of the probability of a second wave");
+    app.add_option("--min-runs", conf_stopping.min_runs, "Adaptive sweeps: replicas per point before stopping")
+       ->check(CLI::PositiveNumber);
+    app.add_option("--max-runs", conf_stopping.max_runs, "Adaptive sweeps: replica limit per point")
+       ->check(CLI::PositiveNumber);
+    app.add_flag("--longest-first", conf_longest_first,
+                 "Sweeps: estimate the cost of each point with a small pilot run and start the costliest first");
+    app.add_option("--engine", conf_engine,
+                   "Single-run engine: sequential, conservative (node partitions on --threads threads, "
+                   "synchronized in lookahead windows), timewarp (optimistic partitions with rollback) or daystep "
+                   "(the daily all-to-all model of simul_to_send_2.py on --threads threads) or multiqueue (threads "
+                   "sharing a relaxed priority queue: approximate event order, for exploration only) or, in the MPI "
+                   "build, distributed (one partition per MPI rank)")
+       ->check(CLI::IsMember(engines));
+    app.add_option("--validate-engine", conf_validate_engine_runs,
+                   "Compare this many sequential and --engine runs, then exit");
+    app.add_option("--validate-fast-math", conf_validate_runs,
+                   "Validate fast-math mode: compare this many precise and fast runs, then exit");
+    app.add_flag("--check-determinism", conf_check_determinism,
+                 "Run every deterministic engine and ensemble mode on 1, 4 and 32 threads, compare, then exit");
+    app.add_option("--bench-mailbox", conf_bench_messages,
+                   "Benchmark the cross-thread mailboxes: --threads threads send this many messages each, then exit")
+       ->check(CLI::PositiveNumber);
+
     try {
         app.parse(argc, argv);
     } catch (const CLI::ParseError &e) {
         return app.exit(e);
     }
 
+    if (conf_bench_messages > 0) {
+        return epi::bench::mailboxes(conf_threads, conf_bench_messages, std::cout);
+    }
+
+    if (conf_sweep_file.empty() && conf_resume_file.empty() && (n_option->count() == 0 || t_option->count() == 0 || beta_option->count() == 0)) {
+        std::cerr << "--num-people, --time and --beta are required" << std::endl;
+        return 1;
+    }
+
+    if (conf_recovery == "erlang" && (conf_rec_shape < 1 || conf_rec_shape != std::floor(conf_rec_shape))) {
+        std::cerr << "--recovery erlang needs an integer --recovery-shape of at least 1" << std::endl;
+        return 1;
+    }
+
+    if (seed_option->count() == 0) {
+        conf_seed = epi::random_seed();
+    }
+#ifdef EPI_MPI
+    // Every rank runs with rank 0's seed
+    MPI_Bcast(&conf_seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (conf_engine != "distributed" && epi::MpiSession::size() > 1) {
+        if (root) {
+            std::cerr << "only --engine distributed runs across MPI ranks" << std::endl;
+        }
+        return 1;
+    }
+#endif
+
     // init config
     config config_obj = {.N = conf_N, // Renamed to avoid conflict with 'config' type
                      .t_max = conf_t_max,
@@ -70,19 +227,189 @@ int main(int argc, char **argv) {
                      .sp_lambda = conf_sp_lambda,
                      .n_initial = conf_n_initial,
                      .susc_initial = conf_susc_initial,
-                     .output_file = conf_output_file};
+                     .output_file = conf_output_file,
+                     .quiet = false,
+                     // Constant-length infections keep the exact thinning sampler
+                     .contact_cache_quantum = conf_recovery == "const" ? 0.0 : conf_cache_quantum,
+                     .contact_cache_entries = conf_cache_entries,
+                     .seed = conf_seed,
+                     .stream = conf_stream,
+                     .crn = app.count("--crn") > 0,
+                     .antithetic = false};
+
+    epi::sweep::Grid sweep_grid = {};
+    if (!conf_sweep_file.empty()) {
+        try {
+            sweep_grid = epi::sweep::load_ini(conf_sweep_file, config_obj);
+            sweep_grid.stopping = conf_stopping;
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (seed_option->count() > 0) { // the command line wins over the sweep file
+            config_obj.seed = conf_seed;
+        }
+    }
+    const epi::checkpoint::ModelChoice model_choice = {.recovery = conf_recovery,
+                                                       .recovery_mean = conf_rec_length,
+                                                       .recovery_shape = conf_rec_shape,
+                                                       .susceptibility = conf_susceptibility,
+                                                       .immunity_time = conf_time_to_imm,
+                                                       .infectivity_file = conf_infectivity_file,
+                                                       .fast_math = conf_fast_math};
+    std::optional<epi::checkpoint::Checkpoint> resumed;
+    if (!conf_resume_file.empty()) {
+        try {
+            resumed = epi::checkpoint::read(conf_resume_file);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        // The model functions are rebuilt from the command line, which must select the ones of the checkpoint
+        if (resumed->models.describe() != model_choice.describe()) {
+            std::cerr << conf_resume_file << " was written with " << resumed->models.describe()
+                      << ", not " << model_choice.describe() << std::endl;
+            return 1;
+        }
+        std::string output_file = config_obj.output_file;
+        bool quiet = config_obj.quiet;
+        config_obj = resumed->cfg;
+        config_obj.output_file = output_file;
+        config_obj.quiet = quiet;
+        if (t_option->count() > 0) {
+            config_obj.t_max = conf_t_max;
+        }
+    }
+    if (root && seed_option->count() == 0 && config_obj.seed == conf_seed) {
+        std::cerr << "seed: " << conf_seed << std::endl;
+    }
 
 //    auto infectivity_func = epi::infect::create_const_infectivity_function(config_obj.beta);
-    auto infectivity_func =
-        epi::infect::create_lognormal_infectivity_function(config_obj.inf_scale, config_obj.inf_mean, config_obj.inf_k);
-    
-//    auto susc_func = epi::infect::create_exp_susceptibility_function(conf_time_to_imm);
-    auto susc_func = epi::infect::create_sigmoid_susceptibility_function(config_obj.susc_k, config_obj.susc_l, config_obj.susc_x0);
+    std::optional<InfectivityProfile> empirical_profile;
+    if (!conf_infectivity_file.empty()) {
+        try {
+            empirical_profile = epi::infect::create_empirical_infectivity_profile(conf_infectivity_file);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-//    auto recovery_func = epi::infect::create_poisson_recovery_function(conf_rec_length);
-    auto recovery_func = epi::infect::create_const_recovery_function(config_obj.inf_length);
+    epi::RecoverySampler recovery_func;
+    if (conf_recovery == "poisson") {
+        recovery_func = epi::infect::create_poisson_recovery_function(conf_rec_length);
+    } else if (conf_recovery == "gamma") {
+        recovery_func = epi::infect::create_gamma_recovery_function(conf_rec_length, conf_rec_shape);
+    } else if (conf_recovery == "erlang") {
+        recovery_func = epi::infect::create_erlang_recovery_function(conf_rec_length, (int) conf_rec_shape);
+    } else {
+        recovery_func = epi::infect::create_const_recovery_function(config_obj.inf_length);
+    }
+
+    // The model, with the exp/log of its curves instantiated for the precise or fast math mode
+    auto make_model = [&](bool fast_math) {
+        InfectivityProfile infectivity_profile = empirical_profile.value_or(InfectivityProfile{
+            .max_function_value = 0,
+            .infectivity_function = epi::infect::create_lognormal_infectivity_function(
+                config_obj.inf_scale, config_obj.inf_mean, config_obj.inf_k, fast_math)});
+        auto susc_func = conf_susceptibility == "exp"
+                         ? epi::infect::create_exp_susceptibility_function(conf_time_to_imm, fast_math)
+                         : epi::infect::create_sigmoid_susceptibility_function(config_obj.susc_k, config_obj.susc_l,
+                                                                               config_obj.susc_x0, fast_math);
+        return Model{infectivity_profile, susc_func, recovery_func};
+    };
+    const Model model = make_model(conf_fast_math);
+    epi::ensemble::RunOptions run_options = {
+        .threads = conf_threads,
+        .output = conf_replica_output == "per-replica" ? epi::ensemble::ReplicaOutput::PerReplica
+                  : conf_replica_output == "none"      ? epi::ensemble::ReplicaOutput::None
+                                                       : epi::ensemble::ReplicaOutput::Aggregate,
+        .output_file = conf_output_file,
+        .longest_first = conf_longest_first};
 
-    Simulation simulation = Simulation(config_obj, infectivity_func, susc_func, recovery_func);
+    if (!conf_sweep_file.empty()) {
+        epi::sweep::run(config_obj, model, sweep_grid, run_options, std::cout);
+        return 0;
+    }
+
+    if (conf_validate_runs > 0) {
+        return epi::ensemble::validate_fast_math(config_obj, make_model(false), make_model(true), conf_validate_runs,
+                                                 run_options, std::cout);
+    }
+
+    const auto engine = conf_engine == "conservative" ? epi::ensemble::Engine::Conservative
+                        : conf_engine == "timewarp"   ? epi::ensemble::Engine::TimeWarp
+                        : conf_engine == "daystep"    ? epi::ensemble::Engine::DayStep
+                        : conf_engine == "multiqueue" ? epi::ensemble::Engine::MultiQueue
+                                                      : epi::ensemble::Engine::Sequential;
+    if (conf_validate_engine_runs > 0) {
+        if (engine == epi::ensemble::Engine::Sequential || engine == epi::ensemble::Engine::DayStep) {
+            std::cerr << "--validate-engine needs a parallel event-driven --engine" << std::endl;
+            return 1;
+        }
+        return epi::ensemble::validate_engine(config_obj, model, engine, conf_validate_engine_runs, run_options,
+                                              std::cout);
+    }
+
+    if (conf_check_determinism) {
+        return epi::ensemble::check_determinism(config_obj, model, std::cout);
+    }
+
+    if (conf_replicas > 0 && conf_burn_in > 0) {
+        epi::ensemble::run_forks(config_obj, model, conf_burn_in, conf_replicas, run_options, std::cout);
+        return 0;
+    }
+
+    if (conf_replicas > 0) {
+        auto design = conf_design == "antithetic" ? epi::ensemble::Design::Antithetic
+                      : conf_design == "sobol"    ? epi::ensemble::Design::Sobol
+                                                  : epi::ensemble::Design::MonteCarlo;
+        try {
+            epi::ensemble::run_design(config_obj, model, design, conf_replicas, conf_randomizations, run_options,
+                                      std::cout);
+        } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (conf_engine != "sequential" && (resumed || conf_checkpoint_every > 0)) {
+        std::cerr << "checkpoints need the sequential engine" << std::endl;
+        return 1;
+    }
+    if (engine == epi::ensemble::Engine::DayStep) {
+        DayStepSimulation simulation(config_obj, model, conf_threads);
+        simulation.simulate();
+        return 0;
+    }
+    auto kernel = std::make_shared<const epi::Kernel>(model.infectivity, config_obj.inf_length,
+                                                      config_obj.contact_cache_quantum,
+                                                      config_obj.contact_cache_entries);
+    if (engine == epi::ensemble::Engine::Conservative) {
+        ParallelSimulation simulation(config_obj, model, kernel, conf_threads);
+        simulation.simulate();
+        return 0;
+    }
+    if (engine == epi::ensemble::Engine::TimeWarp) {
+        TimeWarpSimulation simulation(config_obj, model, kernel, conf_threads);
+        simulation.simulate();
+        return 0;
+    }
+    if (engine == epi::ensemble::Engine::MultiQueue) {
+        RelaxedSimulation simulation(config_obj, model, kernel, conf_threads);
+        simulation.simulate();
+        return 0;
+    }
+#ifdef EPI_MPI
+    if (conf_engine == "distributed") {
+        DistributedSimulation simulation(config_obj, model, kernel);
+        simulation.simulate();
+        return 0;
+    }
+#endif
+    Simulation simulation = resumed ? Simulation(config_obj, model, kernel, resumed->state)
+                                    : Simulation(config_obj, model, kernel);
 
 /*
      std::vector<double> sp_inf_times =
@@ -108,7 +435,15 @@ int main(int argc, char **argv) {
 */
 
 
-    simulation.simulate();
+    if (!resumed) {
+        simulation.start();
+    }
+    if (conf_checkpoint_every > 0) {
+        epi::checkpoint::Writer writer(conf_checkpoint_file, model_choice);
+        epi::checkpoint::run(simulation, config_obj, conf_checkpoint_every, writer);
+    } else {
+        simulation.run_until(config_obj.t_max);
+    }
     return 0;
 }
 
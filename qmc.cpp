@@ -0,0 +1,80 @@
+#include "qmc.h"
+#include <stdexcept>
+
+namespace epi {
+
+namespace {
+
+struct PrimitivePolynomial {
+    int degree;
+    uint32_t coefficients; // middle coefficients, highest first
+    uint32_t m[7];         // initial direction integers
+};
+
+// Dimensions 2..21 of Joe & Kuo's new-joe-kuo-6.21201 table; dimension 1 is the van der Corput sequence.
+const PrimitivePolynomial polynomials[SobolSequence::max_dimensions - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+};
+
+} // namespace
+
+SobolSequence::SobolSequence(int dimensions, std::vector<uint64_t> shift)
+    : dimensions_(dimensions), shift_(std::move(shift)), directions_((size_t) dimensions * 32) {
+    if (dimensions < 1 || dimensions > max_dimensions || (int) shift_.size() != dimensions) {
+        throw std::invalid_argument("Sobol sequence supports 1 to 21 dimensions with one shift word each");
+    }
+    for (int k = 0; k < 32; k++) {
+        directions_[k] = 1u << (31 - k);
+    }
+    for (int d = 1; d < dimensions; d++) {
+        const PrimitivePolynomial &p = polynomials[d - 1];
+        uint32_t *v = &directions_[(size_t) d * 32];
+        for (int k = 0; k < p.degree; k++) {
+            v[k] = p.m[k] << (31 - k);
+        }
+        for (int k = p.degree; k < 32; k++) {
+            v[k] = v[k - p.degree] ^ (v[k - p.degree] >> p.degree);
+            for (int i = 1; i < p.degree; i++) {
+                if ((p.coefficients >> (p.degree - 1 - i)) & 1) {
+                    v[k] ^= v[k - i];
+                }
+            }
+        }
+    }
+}
+
+std::vector<uint64_t> SobolSequence::point(uint64_t index) const {
+    const uint64_t gray = index ^ (index >> 1);
+    std::vector<uint64_t> words(dimensions_);
+    for (int d = 0; d < dimensions_; d++) {
+        uint32_t x = 0;
+        for (int k = 0; k < 32; k++) {
+            if ((gray >> k) & 1) {
+                x ^= directions_[(size_t) d * 32 + k];
+            }
+        }
+        words[d] = ((uint64_t) x << 32) ^ shift_[d];
+    }
+    return words;
+}
+
+} // namespace epi
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace epi {
+
+/// Sobol low-discrepancy sequence in up to `max_dimensions` dimensions (Joe & Kuo direction numbers),
+/// randomized by a digital shift. Points are produced as 64-bit words (32 Sobol bits on top, the shift below),
+/// the same form as raw RNG output, so they can stand in for the first draws of a replica.
+class SobolSequence {
+public:
+    static constexpr int max_dimensions = 21;
+
+    /// `shift` holds one 64-bit digital shift per dimension (all zeros gives the plain sequence).
+    SobolSequence(int dimensions, std::vector<uint64_t> shift);
+
+    [[nodiscard]] int dimensions() const { return dimensions_; }
+
+    /// Point `index` of the shifted sequence.
+    [[nodiscard]] std::vector<uint64_t> point(uint64_t index) const;
+
+private:
+    int dimensions_;
+    std::vector<uint64_t> shift_;
+    std::vector<uint32_t> directions_; // 32 per dimension
+};
+
+} // namespace epi
@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace epi {
+
+/// Philox4x32-10 block function (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11):
+/// a bijection of a 128-bit counter under a 64-bit key, so any position of any stream can be computed directly.
+struct Philox4x32 {
+    using counter_type = std::array<uint32_t, 4>;
+    using key_type = std::array<uint32_t, 2>;
+
+    static constexpr uint32_t M0 = 0xD2511F53;
+    static constexpr uint32_t M1 = 0xCD9E8D57;
+    static constexpr uint32_t W0 = 0x9E3779B9;
+    static constexpr uint32_t W1 = 0xBB67AE85;
+
+    static counter_type generate(counter_type ctr, key_type key) {
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t) M0 * ctr[0];
+            uint64_t p1 = (uint64_t) M1 * ctr[2];
+            ctr = {(uint32_t) (p1 >> 32) ^ ctr[1] ^ key[0], (uint32_t) p1,
+                   (uint32_t) (p0 >> 32) ^ ctr[3] ^ key[1], (uint32_t) p0};
+            key[0] += W0;
+            key[1] += W1;
+        }
+        return ctr;
+    }
+};
+
+/// Mixes two identifiers into one 64-bit stream id (splitmix64 finalizer), e.g. (replica, thread).
+inline uint64_t substream(uint64_t a, uint64_t b) {
+    uint64_t z = a * 0x9E3779B97F4A7C15ULL + b + 0x632BE59BD9B4E019ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/// Counter-based engine over Philox4x32-10: key = seed, counter = (position, stream id).
+/// Different (seed, stream) pairs give independent streams; the whole state is 40 bytes and reseeding is free.
+/// Satisfies UniformRandomBitGenerator with 64-bit output.
+class PhiloxEngine {
+public:
+    using result_type = uint64_t;
+
+    explicit PhiloxEngine(uint64_t seed = 0, uint64_t stream = 0) { reseed(seed, stream); }
+
+    void reseed(uint64_t seed, uint64_t stream) {
+        seed_ = seed;
+        stream_ = stream;
+        position_ = 0;
+        buffered_ = false;
+    }
+
+    result_type operator()() {
+        if (buffered_) {
+            buffered_ = false;
+            return spare_;
+        }
+        Philox4x32::counter_type ctr = {(uint32_t) position_, (uint32_t) (position_ >> 32),
+                                        (uint32_t) stream_, (uint32_t) (stream_ >> 32)};
+        Philox4x32::key_type key = {(uint32_t) seed_, (uint32_t) (seed_ >> 32)};
+        position_++;
+        auto out = Philox4x32::generate(ctr, key);
+        spare_ = ((uint64_t) out[3] << 32) | out[2];
+        buffered_ = true;
+        return ((uint64_t) out[1] << 32) | out[0];
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    [[nodiscard]] uint64_t seed() const { return seed_; }
+    [[nodiscard]] uint64_t stream() const { return stream_; }
+
+private:
+    uint64_t seed_;
+    uint64_t stream_;
+    uint64_t position_;
+    uint64_t spare_ = 0;
+    bool buffered_;
+};
+
+/// Uniform double in the open interval (0, 1) from the top 53 bits of a 64-bit word.
+inline double to_uniform(uint64_t bits) {
+    return ((double) (bits >> 11) + 0.5) * 0x1.0p-53;
+}
+
+/// Philox4x32-10 evaluated for `lanes` consecutive counters at a time in struct-of-arrays form, so that the rounds
+/// compile to SIMD 32x32->64 multiplies, refilling a buffer that scalar draws pop from.
+/// Produces exactly the sequence of PhiloxEngine for the same (seed, stream) unless antithetic or prefixed. The state is trivially copyable,
+/// and the constexpr constructor lets it live in a thread_local without an initialization guard.
+class BlockRng {
+public:
+    using result_type = uint64_t;
+
+    static constexpr int lanes = 16;
+    static constexpr int block_words = 2 * lanes;
+
+    constexpr explicit BlockRng(uint64_t seed = 0, uint64_t stream = 0)
+        : seed_(seed), stream_(stream), position_(0), mask_(0), next_(block_words) {}
+
+    /// Restarts at the beginning of stream `stream` of `seed` (the antithetic setting is kept, a prefix is not).
+    void reseed(uint64_t seed, uint64_t stream) {
+        seed_ = seed;
+        stream_ = stream;
+        position_ = 0;
+        next_ = block_words;
+        prefixed_ = false;
+    }
+
+    /// Antithetic mode complements every output word, mapping each uniform u to (about) 1 - u.
+    void set_antithetic(bool antithetic) {
+        mask_ = antithetic ? ~(uint64_t) 0 : 0;
+    }
+
+    /// Called right after reseed(): the first n (at most block_words) outputs of the stream become `words`, e.g. the
+    /// coordinates of a quasi-random point driving a replica's first draws; generated words follow.
+    void set_prefix(const uint64_t *words, int n) {
+        if (n > block_words) n = block_words;
+        generate(buffer_);
+        for (int i = 0; i < n; i++) {
+            buffer_[i] = words[i];
+        }
+        next_ = 0;
+        prefixed_ = n > 0;
+    }
+
+    /// The words carry structure (antithetic pairing or a prefix still being read) that only a monotone map of
+    /// each word to its variate preserves: samplers should use inversion rather than e.g. a ziggurat.
+    [[nodiscard]] bool structured() const { return mask_ != 0 || prefixed_; }
+
+    result_type operator()() {
+        if (next_ == block_words) {
+            generate(buffer_);
+            next_ = 0;
+            prefixed_ = false;
+        }
+        return buffer_[next_++];
+    }
+
+    /// Next n words of the stream; whole blocks are generated straight into `out`.
+    void fill(uint64_t *out, size_t n) {
+        while (n > 0 && next_ < block_words) {
+            *out++ = buffer_[next_++];
+            n--;
+        }
+        for (; n >= (size_t) block_words; n -= block_words, out += block_words) {
+            generate(out);
+            prefixed_ = false;
+        }
+        for (; n > 0; n--) {
+            *out++ = (*this)();
+        }
+    }
+
+    /// Next n uniforms in (0, 1), as consecutive calls of to_uniform((*this)()) would return them.
+    void uniforms(double *out, size_t n) {
+        uint64_t words[4 * block_words]; // filled a chunk at a time, which gives the same words as one fill
+        while (n > 0) {
+            const size_t m = std::min(n, (size_t) (4 * block_words));
+            fill(words, m);
+            for (size_t i = 0; i < m; i++) {
+                out[i] = to_uniform(words[i]);
+            }
+            out += m;
+            n -= m;
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    [[nodiscard]] uint64_t seed() const { return seed_; }
+    [[nodiscard]] uint64_t stream() const { return stream_; }
+
+private:
+    void generate(uint64_t *out) {
+        uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+        for (int i = 0; i < lanes; i++) {
+            uint64_t counter = position_ + i;
+            c0[i] = (uint32_t) counter;
+            c1[i] = (uint32_t) (counter >> 32);
+            c2[i] = (uint32_t) stream_;
+            c3[i] = (uint32_t) (stream_ >> 32);
+        }
+        uint32_t k0 = (uint32_t) seed_, k1 = (uint32_t) (seed_ >> 32);
+        for (int round = 0; round < 10; round++) {
+            // Fully unrolling the lanes turns the arrays into scalars and defeats vectorization at -O3
+#pragma GCC unroll 1
+            for (int i = 0; i < lanes; i++) {
+                uint64_t p0 = (uint64_t) Philox4x32::M0 * c0[i];
+                uint64_t p1 = (uint64_t) Philox4x32::M1 * c2[i];
+                uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1[i] ^ k0;
+                uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3[i] ^ k1;
+                c0[i] = n0;
+                c1[i] = (uint32_t) p1;
+                c2[i] = n2;
+                c3[i] = (uint32_t) p0;
+            }
+            k0 += Philox4x32::W0;
+            k1 += Philox4x32::W1;
+        }
+        for (int i = 0; i < lanes; i++) {
+            out[2 * i] = (((uint64_t) c1[i] << 32) | c0[i]) ^ mask_;
+            out[2 * i + 1] = (((uint64_t) c3[i] << 32) | c2[i]) ^ mask_;
+        }
+        position_ += lanes;
+    }
+
+    uint64_t seed_;
+    uint64_t stream_;
+    uint64_t position_; // next counter to generate
+    uint64_t mask_;     // XORed into every output word (antithetic mode)
+    int next_;          // next unread word of buffer_
+    bool prefixed_ = false; // buffer_ starts with set_prefix() words
+    alignas(64) uint64_t buffer_[block_words] = {};
+};
+
+} // namespace epi
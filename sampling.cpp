@@ -0,0 +1,164 @@
+#include "sampling.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace epi {
+
+AliasTable::AliasTable(const std::vector<double>& weights) : prob_(weights.size()), alias_(weights.size()) {
+    const int n = (int) weights.size();
+    double total = 0;
+    for (double w : weights) total += w;
+    if (n == 0 || total <= 0) {
+        throw std::invalid_argument("alias table needs at least one positive weight");
+    }
+
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = weights[i] * n / total;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int s = small.back();
+        small.pop_back();
+        int l = large.back();
+        prob_[s] = scaled[s];
+        alias_[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Leftovers are 1 up to rounding
+    for (int i : large) {
+        prob_[i] = 1.0;
+        alias_[i] = i;
+    }
+    for (int i : small) {
+        prob_[i] = 1.0;
+        alias_[i] = i;
+    }
+}
+
+EmpiricalProfile::EmpiricalProfile(std::vector<double> tau, std::vector<double> value)
+    : tau_(std::move(tau)), value_(std::move(value)) {
+    if (tau_.size() != value_.size() || tau_.size() < 2) {
+        throw std::invalid_argument("empirical profile needs at least two (tau, value) points");
+    }
+    std::vector<double> areas;
+    cumulative_.push_back(0.0);
+    max_value_ = 0;
+    for (size_t i = 0; i < tau_.size(); i++) {
+        if (value_[i] < 0 || tau_[i] < 0) {
+            throw std::invalid_argument("empirical profile values and taus must be non-negative");
+        }
+        max_value_ = std::max(max_value_, value_[i]);
+        if (i == 0) continue;
+        double h = tau_[i] - tau_[i - 1];
+        if (h <= 0) {
+            throw std::invalid_argument("empirical profile taus must be strictly increasing");
+        }
+        areas.push_back(0.5 * h * (value_[i - 1] + value_[i]));
+        cumulative_.push_back(cumulative_.back() + areas.back());
+    }
+    segments_ = AliasTable(areas);
+}
+
+EmpiricalProfile EmpiricalProfile::load_csv(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("cannot open infectivity profile " + path);
+    }
+    std::vector<double> tau, value;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        if (line.empty() || line[0] == '#') continue;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        double t, v;
+        if (!(fields >> t >> v)) {
+            if (tau.empty()) continue; // header
+            throw std::runtime_error(path + ":" + std::to_string(line_no) + ": expected \"tau,value\"");
+        }
+        tau.push_back(t);
+        value.push_back(v);
+    }
+    return {std::move(tau), std::move(value)};
+}
+
+double EmpiricalProfile::operator()(double tau) const {
+    if (tau < tau_.front() || tau > tau_.back()) {
+        return 0.0;
+    }
+    size_t i = std::upper_bound(tau_.begin(), tau_.end(), tau) - tau_.begin();
+    if (i >= tau_.size()) return value_.back();
+    double f = (tau - tau_[i - 1]) / (tau_[i] - tau_[i - 1]);
+    return value_[i - 1] + f * (value_[i] - value_[i - 1]);
+}
+
+double EmpiricalProfile::sample(double u_segment, double u_position) const {
+    int i = segments_.sample(u_segment);
+    double t0 = tau_[i], h = tau_[i + 1] - tau_[i];
+    double v0 = value_[i], slope = (value_[i + 1] - v0) / h;
+    // Solve v0 x + slope x^2 / 2 = u A for x in [0, h], in the form that is stable for slope -> 0
+    double target = u_position * (cumulative_[i + 1] - cumulative_[i]);
+    if (target <= 0) return t0;
+    double x = 2 * target / (v0 + std::sqrt(v0 * v0 + 2 * slope * target));
+    return t0 + std::min(x, h);
+}
+
+ContactTimeCache::ContactTimeCache(const std::function<double(double)>& infectivity, double integral,
+                                   double quantum, int max_entries)
+    : h_(quantum / 4), max_length_(quantum * max_entries), integral_(integral) {
+    if (quantum <= 0 || max_entries < 1 || integral <= 0) {
+        throw std::invalid_argument("contact time cache needs a positive quantum, entries and integral");
+    }
+
+    // Cumulative infectivity of the curve interpolated linearly on the grid (exact trapezoids)
+    const int n_cells = max_entries * 4;
+    value_.resize(n_cells + 1);
+    cumulative_.assign(n_cells + 1, 0.0);
+    value_[0] = infectivity(0.0);
+    for (int i = 1; i <= n_cells; i++) {
+        value_[i] = infectivity(i * h_);
+        cumulative_[i] = cumulative_[i - 1] + 0.5 * (value_[i - 1] + value_[i]) * h_;
+    }
+
+    guide_.resize(n_cells);
+    const double total = cumulative_.back();
+    int cell = 0;
+    for (int g = 0; g < n_cells; g++) {
+        const double level = total * g / n_cells;
+        while (cell < n_cells - 1 && cumulative_[cell + 1] <= level) cell++;
+        guide_[g] = cell;
+    }
+}
+
+double ContactTimeCache::cumulative(double length) const {
+    int i = std::min((int) (length / h_), (int) value_.size() - 2);
+    double x = length - i * h_;
+    double slope = (value_[i + 1] - value_[i]) / h_;
+    return cumulative_[i] + x * (value_[i] + 0.5 * slope * x);
+}
+
+double ContactTimeCache::sample(double length, double u) const {
+    const double level = u * cumulative(length);
+    const double total = cumulative_.back();
+    const int n_cells = (int) guide_.size();
+    int i = total > 0 ? guide_[std::min((int) (level / total * n_cells), n_cells - 1)] : 0;
+    while (i < n_cells - 1 && cumulative_[i + 1] <= level) i++;
+    // Solve v0 x + slope x^2 / 2 = level - cumulative_[i] for x in [0, h], as EmpiricalProfile::sample does
+    double v0 = value_[i], slope = (value_[i + 1] - v0) / h_;
+    double target = level - cumulative_[i];
+    double x = target > 0 ? 2 * target / (v0 + std::sqrt(v0 * v0 + 2 * slope * target)) : 0.0;
+    double t = i * h_ + std::min(x, h_);
+    return t < length ? t : std::nextafter(length, 0.0);
+}
+
+} // namespace epi
@@ -0,0 +1,187 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "util.h"
+
+namespace epi {
+
+/// Gamma(shape, scale) sampler (Marsaglia & Tsang, 2000): about 1.03 normal/uniform pairs per draw and a log
+/// only when the squeeze test fails. Shapes below 1 draw Gamma(shape + 1) and scale by u^(1/shape).
+struct GammaSampler {
+    GammaSampler(double shape, double scale)
+        : d((shape < 1 ? shape + 1 : shape) - 1.0 / 3.0), c(1.0 / std::sqrt(9.0 * d)), scale(scale),
+          inv_shape(1.0 / shape), boost(shape < 1) {}
+
+    double operator()() const {
+        for (;;) {
+            double x, v;
+            do {
+                x = normal();
+                v = 1.0 + c * x;
+            } while (v <= 0);
+            v = v * v * v;
+            double u = uniform();
+            double x2 = x * x;
+            if (u < 1.0 - 0.0331 * x2 * x2 || math::log(u) < 0.5 * x2 + d * (1.0 - v + math::log(v))) {
+                double g = d * v * scale;
+                return boost ? g * std::pow(uniform(), inv_shape) : g;
+            }
+        }
+    }
+
+    double d, c, scale, inv_shape;
+    bool boost;
+};
+
+/// Erlang(k, scale) sampler: scale times a sum of k ziggurat exponentials, no transcendental calls.
+/// Shapes above `max_sum_shape` use GammaSampler, whose cost does not grow with k.
+struct ErlangSampler {
+    static constexpr int max_sum_shape = 32;
+
+    ErlangSampler(int k, double scale) : k(k), scale(scale), gamma(k, scale) {}
+
+    double operator()() const {
+        if (k > max_sum_shape) {
+            return gamma();
+        }
+        double sum = 0;
+        for (int i = 0; i < k; i++) {
+            sum += exponential();
+        }
+        return scale * sum;
+    }
+
+    int k;
+    double scale;
+    GammaSampler gamma;
+};
+
+/// Recovery-length distribution of a model. The built-in distributions are held by value and dispatched with
+/// std::visit, so the engines call their samplers inline rather than through a std::function; any other
+/// function of the infection time is kept as one.
+class RecoverySampler {
+public:
+    struct Constant {
+        double length;
+    };
+    struct Exponential {
+        double mean;
+    };
+
+    RecoverySampler() : sampler_(Constant{0}) {}
+    RecoverySampler(Constant c) : sampler_(c) {}
+    RecoverySampler(Exponential e) : sampler_(e) {}
+    RecoverySampler(GammaSampler g) : sampler_(g) {}
+    RecoverySampler(ErlangSampler e) : sampler_(e) {}
+    template <class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, RecoverySampler> &&
+                                                std::is_invocable_r_v<double, F, double>>>
+    RecoverySampler(F f) : sampler_(Constant{0}), custom_(std::move(f)) {}
+
+    /// Recovery length of an infection at `time`.
+    double operator()(double time) const {
+        if (custom_) {
+            return custom_(time);
+        }
+        return std::visit([](const auto& s) -> double {
+            using S = std::decay_t<decltype(s)>;
+            if constexpr (std::is_same_v<S, Constant>) {
+                return s.length;
+            } else if constexpr (std::is_same_v<S, Exponential>) {
+                return exponential() * s.mean;
+            } else {
+                return s();
+            }
+        }, sampler_);
+    }
+
+private:
+    std::variant<Constant, Exponential, GammaSampler, ErlangSampler> sampler_;
+    std::function<double(double)> custom_; // set for any other distribution
+};
+
+/// Walker/Vose alias table: O(n) construction, O(1) sampling of an index with probability
+/// proportional to its weight.
+class AliasTable {
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<double>& weights);
+
+    /// Maps one uniform u in [0, 1) to an index (the fractional part of u * n picks the column side).
+    [[nodiscard]] int sample(double u) const {
+        double x = u * (double) prob_.size();
+        int i = (int) x;
+        if (i >= (int) prob_.size()) i = (int) prob_.size() - 1;
+        return (x - i) < prob_[i] ? i : alias_[i];
+    }
+
+    [[nodiscard]] size_t size() const { return prob_.size(); }
+
+private:
+    std::vector<double> prob_;
+    std::vector<int> alias_;
+};
+
+/// Piecewise-linear infectivity curve tabulated at (tau, value) points.
+/// Evaluation interpolates between points; sampling draws tau from the curve normalized to unit area
+/// in O(1): an alias table picks the segment, then the linear density is inverted in closed form.
+class EmpiricalProfile {
+public:
+    EmpiricalProfile(std::vector<double> tau, std::vector<double> value);
+
+    /// Reads a CSV of "tau,value" rows (a non-numeric header line and '#' comments are skipped).
+    static EmpiricalProfile load_csv(const std::string& path);
+
+    [[nodiscard]] double operator()(double tau) const;
+    [[nodiscard]] double sample(double u_segment, double u_position) const;
+
+    [[nodiscard]] double integral() const { return cumulative_.back(); }
+    [[nodiscard]] double max_value() const { return max_value_; }
+    [[nodiscard]] double support_end() const { return tau_.back(); }
+
+private:
+    std::vector<double> tau_;
+    std::vector<double> value_;
+    std::vector<double> cumulative_; // area up to each point
+    double max_value_;
+    AliasTable segments_;
+};
+
+/// Contact-time sampler for infections of random length. The cumulative infectivity is tabulated once on a grid
+/// four times finer than `quantum` days, up to quantum * max_entries; an infection of any length L below that is
+/// then sampled exactly for the curve interpolated linearly between the grid points: its expected contact count
+/// uses the cumulative at L itself and each contact time inverts it in closed form. So the only approximation is
+/// the interpolation, whose density error is at most max|f''| h^2 / 8 for grid step h, and a contact costs one
+/// guide-table lookup, a short forward scan and a square root whatever the length. Longer lengths are not
+/// covered; memory stays at about 3 * 4 * max_entries doubles.
+class ContactTimeCache {
+public:
+    ContactTimeCache(const std::function<double(double)>& infectivity, double integral, double quantum,
+                     int max_entries);
+
+    [[nodiscard]] bool covers(double length) const { return length < max_length_; }
+
+    /// Expected contacts per unit beta for an infection of `length`.
+    [[nodiscard]] double count_mean(double length) const { return length * cumulative(length) / integral_; }
+
+    /// Contact time in [0, length) from one uniform.
+    [[nodiscard]] double sample(double length, double u) const;
+
+private:
+    /// Infectivity area over [0, length) of the interpolated curve.
+    [[nodiscard]] double cumulative(double length) const;
+
+    double h_;
+    double max_length_;
+    double integral_;
+    std::vector<double> value_;      // the curve at i * h
+    std::vector<double> cumulative_; // area up to i * h
+    std::vector<int> guide_;         // guide_[g]: first cell whose area ends above g / size of the total
+};
+
+} // namespace epi
@@ -0,0 +1,136 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace epi::stats {
+
+/// Streaming mean/variance (Welford's algorithm).
+struct Welford {
+    int64_t n = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void add(double x) {
+        n++;
+        double delta = x - mean;
+        mean += delta / (double) n;
+        m2 += delta * (x - mean);
+    }
+
+    [[nodiscard]] double variance() const { return n > 1 ? m2 / (double) (n - 1) : 0.0; }
+    [[nodiscard]] double stddev() const { return std::sqrt(variance()); }
+    [[nodiscard]] double std_error() const { return n > 0 ? std::sqrt(variance() / (double) n) : 0.0; }
+
+    /// Combines the moments of two disjoint samples (Chan et al.).
+    void merge(const Welford& other) {
+        if (other.n == 0) return;
+        int64_t total = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta * (double) other.n / (double) total;
+        m2 += other.m2 + delta * delta * (double) n * (double) other.n / (double) total;
+        n = total;
+    }
+};
+
+/// KLL quantile sketch (Karnin, Lang & Liberty): a stack of compactors where level h holds items of weight 2^h
+/// and a full level passes every other item of its sorted contents up. Rank error is about 1.7 / k with high
+/// probability; inputs of up to about k items are kept exactly. Compactions alternate between keeping the odd
+/// and the even items instead of flipping coins, so the sketch is a deterministic function of its input sequence
+/// (and of the merge order).
+class KllSketch {
+public:
+    explicit KllSketch(int k = 200) : k_(std::max(k, 8)) {}
+
+    void add(double x) {
+        if (levels_.empty()) levels_.emplace_back();
+        levels_[0].push_back(x);
+        n_++;
+        if (levels_[0].size() >= capacity(0)) compress();
+    }
+
+    void merge(const KllSketch& other) {
+        if (levels_.size() < other.levels_.size()) levels_.resize(other.levels_.size());
+        for (size_t h = 0; h < other.levels_.size(); h++) {
+            levels_[h].insert(levels_[h].end(), other.levels_[h].begin(), other.levels_[h].end());
+        }
+        n_ += other.n_;
+        compress();
+    }
+
+    [[nodiscard]] int64_t count() const { return n_; }
+
+    /// Smallest retained item whose weighted rank reaches q * count(); NaN when empty.
+    [[nodiscard]] double quantile(double q) const {
+        std::vector<std::pair<double, int64_t>> items;
+        for (size_t h = 0; h < levels_.size(); h++) {
+            for (double x : levels_[h]) items.emplace_back(x, (int64_t) 1 << h);
+        }
+        if (items.empty()) return NAN;
+        std::sort(items.begin(), items.end());
+        int64_t total = 0;
+        for (const auto& item : items) total += item.second;
+        const double target = std::clamp(q, 0.0, 1.0) * (double) total;
+        int64_t rank = 0;
+        for (const auto& [x, weight] : items) {
+            rank += weight;
+            if ((double) rank >= target) return x;
+        }
+        return items.back().first;
+    }
+
+private:
+    // Level h of H holds up to k (2/3)^(H - 1 - h) items, at least 2
+    [[nodiscard]] size_t capacity(size_t h) const {
+        const size_t depth = levels_.size() - 1 - h;
+        return std::max<size_t>(2, (size_t) std::ceil(k_ * std::pow(2.0 / 3.0, (double) depth)));
+    }
+
+    [[nodiscard]] size_t size() const {
+        size_t total = 0;
+        for (const auto& level : levels_) total += level.size();
+        return total;
+    }
+
+    [[nodiscard]] size_t total_capacity() const {
+        size_t total = 0;
+        for (size_t h = 0; h < levels_.size(); h++) total += capacity(h);
+        return total;
+    }
+
+    void compress() {
+        while (size() >= total_capacity()) {
+            for (size_t h = 0; h < levels_.size(); h++) {
+                if (levels_[h].size() < capacity(h)) continue;
+                if (h + 1 == levels_.size()) levels_.emplace_back();
+                std::vector<double>& level = levels_[h];
+                std::sort(level.begin(), level.end());
+                // An odd item out stays behind at this level
+                const size_t pairs = level.size() / 2;
+                std::vector<double>& up = levels_[h + 1];
+                for (size_t i = 0; i < pairs; i++) up.push_back(level[2 * i + parity_]);
+                parity_ ^= 1;
+                level.erase(level.begin(), level.begin() + (std::ptrdiff_t) (2 * pairs));
+                break;
+            }
+        }
+    }
+
+    int k_;
+    int64_t n_ = 0;
+    unsigned parity_ = 0;
+    std::vector<std::vector<double>> levels_;
+};
+
+/// Welch's z statistic for the difference of two sample means.
+inline double welch_z(const Welford& a, const Welford& b) {
+    double se = std::sqrt(a.std_error() * a.std_error() + b.std_error() * b.std_error());
+    if (se == 0) {
+        return a.mean == b.mean ? 0.0 : HUGE_VAL;
+    }
+    return (a.mean - b.mean) / se;
+}
+
+} // namespace epi::stats
@@ -0,0 +1,330 @@
+#include "sweep.h"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include "Kernel.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "rng.h"
+#include "stats.h"
+
+namespace epi::sweep {
+
+namespace {
+
+std::string trim(const std::string& s) {
+    const char* space = " \t\r\n";
+    size_t begin = s.find_first_not_of(space);
+    if (begin == std::string::npos) return "";
+    return s.substr(begin, s.find_last_not_of(space) - begin + 1);
+}
+
+std::map<std::string, std::string> read_ini(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("cannot open sweep file " + path);
+    }
+    std::map<std::string, std::string> values;
+    std::string line;
+    for (int line_no = 1; std::getline(in, line); line_no++) {
+        line = trim(line.substr(0, line.find_first_of(";#")));
+        if (line.empty() || line.front() == '[') continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no) + ": expected key = value");
+        }
+        values[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+    }
+    return values;
+}
+
+struct Replica {
+    int point;
+    config cfg;
+};
+
+// Expected events of one run at each beta, from a few runs on a tenth of the population
+std::vector<double> pilot_costs(const config& base, const Model& model, const std::vector<double>& betas,
+                                ThreadPool& pool) {
+    const int pilot_runs = 4;
+    config pilot = base;
+    pilot.N = std::max(std::min(base.N, 1000), base.N / 10);
+    pilot.output_file = "";
+    pilot.quiet = true;
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, pilot.inf_length, pilot.contact_cache_quantum,
+                                                 pilot.contact_cache_entries);
+    std::vector<long> events(betas.size() * pilot_runs);
+    pool.parallel_for((int) events.size(), [&](int i) {
+        config cfg = pilot;
+        cfg.beta = betas[i / pilot_runs];
+        cfg.stream = substream(base.stream + i % pilot_runs, 1); // apart from the streams of the real runs
+        Simulation simulation(cfg, model, kernel);
+        simulation.simulate();
+        events[i] = simulation.events_processed();
+    });
+    std::vector<double> costs(betas.size(), 0.0);
+    for (size_t i = 0; i < events.size(); i++) {
+        costs[i / pilot_runs] += (double) events[i] * base.N / pilot.N / pilot_runs;
+    }
+    return costs;
+}
+
+} // namespace
+
+std::vector<double> Grid::betas() const {
+    // Points are computed from their index so that rounding does not accumulate along the grid
+    int n = beta_step > 0 ? (int) std::floor((beta_to - beta_from) / beta_step + 1e-9) + 1 : 1;
+    std::vector<double> result;
+    for (int i = 0; i < std::max(n, 1); i++) {
+        result.push_back(beta_from + i * beta_step);
+    }
+    return result;
+}
+
+Grid load_ini(const std::string& path, config& base) {
+    Grid grid = {base.beta, base.beta, 0, 1, {}};
+    bool has_beta_to = false;
+    for (const auto& [key, value] : read_ini(path)) {
+        try {
+            if (key == "n_population") base.N = std::stoi(value);
+            else if (key == "t_max") base.t_max = std::stod(value);
+            else if (key == "max_disease_lengh" || key == "max_disease_length") base.inf_length = std::stod(value);
+            else if (key == "beta") grid.beta_from = base.beta = std::stod(value);
+            else if (key == "beta_to") { grid.beta_to = std::stod(value); has_beta_to = true; }
+            else if (key == "beta_step") grid.beta_step = std::stod(value);
+            else if (key == "decay_k") base.susc_k = std::stod(value);
+            else if (key == "decay_l") base.susc_l = std::stod(value);
+            else if (key == "decay_x0") base.susc_x0 = std::stod(value);
+            else if (key == "runs") grid.runs = std::stoi(value);
+            else if (key == "seed") base.seed = std::stoull(value);
+            else throw std::runtime_error(path + ": unknown key " + key);
+        } catch (const std::logic_error&) { // std::invalid_argument, std::out_of_range from the conversions
+            throw std::runtime_error(path + ": bad value for " + key + ": " + value);
+        }
+    }
+    if (!has_beta_to) {
+        grid.beta_to = grid.beta_from;
+    }
+    if (grid.runs < 1 || base.N < 1) {
+        throw std::runtime_error(path + ": runs and n_population must be positive");
+    }
+    return grid;
+}
+
+namespace {
+
+struct PointResult {
+    ensemble::MetricsSummary metrics;
+    ensemble::DailySummary daily;
+};
+
+config replica_config(const config& base, double beta, int r) {
+    config cfg = base;
+    cfg.beta = beta;
+    cfg.stream = base.stream + r;
+    cfg.output_file = "";
+    cfg.quiet = true;
+    return cfg;
+}
+
+// Every point runs grid.runs replicas
+std::vector<PointResult> run_fixed(const config& base, const Model& model, const std::shared_ptr<const Kernel>& kernel,
+                                   const std::vector<double>& betas, int runs, bool keep_daily, bool longest_first,
+                                   ThreadPool& pool, std::vector<double>& seconds) {
+    std::vector<Replica> replicas;
+    for (int p = 0; p < (int) betas.size(); p++) {
+        for (int r = 0; r < runs; r++) {
+            replicas.push_back({p, replica_config(base, betas[p], r)});
+        }
+    }
+    std::vector<ensemble::RunMetrics> metrics(replicas.size());
+    std::vector<ensemble::OrderedSummary> daily(betas.size());
+    ensemble::SimulationRecycler simulations(model, kernel);
+    seconds.assign(replicas.size(), 0.0);
+
+    std::vector<int> order(replicas.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (longest_first && betas.size() > 1) {
+        std::vector<double> costs = pilot_costs(base, model, betas, pool);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return costs[replicas[a].point] > costs[replicas[b].point];
+        });
+    }
+    pool.parallel_for((int) order.size(), [&](int k) {
+        const int i = order[k];
+        const auto start = std::chrono::steady_clock::now();
+        simulations.run(replicas[i].cfg, {}, [&](Simulation& simulation) {
+            simulation.simulate();
+            metrics[i] = ensemble::measure(simulation.get_cases_by_day(), replicas[i].cfg.N);
+            if (keep_daily) {
+                daily[replicas[i].point].submit(i % runs, simulation.get_trajectory());
+            }
+        });
+        seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    });
+
+    // Reductions run in replica order, so the results do not depend on the thread count
+    std::vector<PointResult> points(betas.size());
+    for (size_t i = 0; i < replicas.size(); i++) {
+        points[replicas[i].point].metrics.add(metrics[i]);
+    }
+    for (size_t p = 0; p < betas.size(); p++) {
+        points[p].daily = daily[p].summary();
+    }
+    return points;
+}
+
+// Each point runs replicas until the rule is met. Replicas are folded in index order and a point stops at the
+// first prefix that meets the rule, so the result is that of a sequential run whatever the thread count;
+// replicas that were already running past the stopping point are discarded. Free threads always go to the open
+// point with the fewest replicas started.
+std::vector<PointResult> run_adaptive(const config& base, const Model& model,
+                                      const std::shared_ptr<const Kernel>& kernel, const std::vector<double>& betas,
+                                      const ensemble::StoppingRule& rule, bool keep_daily, ThreadPool& pool,
+                                      std::vector<double>& seconds) {
+    struct Finished {
+        ensemble::RunMetrics metrics;
+        std::vector<DayStats> trajectory;
+    };
+    struct Point {
+        int launched = 0;
+        bool stopped = false;
+        std::map<int, Finished> waiting; // finished ahead of the prefix
+    };
+    std::vector<PointResult> results(betas.size());
+    std::vector<Point> points(betas.size());
+    ensemble::SimulationRecycler simulations(model, kernel);
+    std::mutex mutex;
+
+    // With the mutex held
+    auto next = [&](int& point, int& index) {
+        point = -1;
+        for (int p = 0; p < (int) points.size(); p++) {
+            if (!points[p].stopped && points[p].launched < rule.max_runs
+                && (point < 0 || points[p].launched < points[point].launched)) {
+                point = p;
+            }
+        }
+        if (point < 0) return false;
+        index = points[point].launched++;
+        seconds.push_back(0.0);
+        return true;
+    };
+
+    std::function<void(int, int, size_t)> launch = [&](int p, int r, size_t slot) {
+        pool.submit([&, p, r, slot] {
+            const auto start = std::chrono::steady_clock::now();
+            Finished finished = {};
+            simulations.run(replica_config(base, betas[p], r), {}, [&](Simulation& simulation) {
+                simulation.simulate();
+                finished.metrics = ensemble::measure(simulation.get_cases_by_day(), base.N);
+                if (keep_daily) {
+                    finished.trajectory = simulation.get_trajectory();
+                }
+            });
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            seconds[slot] = elapsed;
+            Point& point = points[p];
+            PointResult& result = results[p];
+            if (!point.stopped) {
+                point.waiting.emplace(r, std::move(finished));
+                for (auto it = point.waiting.begin();
+                     !point.stopped && it != point.waiting.end() && it->first == result.metrics.runs();
+                     it = point.waiting.erase(it)) {
+                    result.metrics.add(it->second.metrics);
+                    if (keep_daily) {
+                        result.daily.add(it->second.trajectory);
+                    }
+                    const int n = (int) result.metrics.runs();
+                    point.stopped = (n >= rule.min_runs && result.metrics.meets(rule)) || n >= rule.max_runs;
+                }
+                if (point.stopped) {
+                    point.waiting.clear();
+                }
+            }
+            int next_point, next_index;
+            if (next(next_point, next_index)) {
+                launch(next_point, next_index, seconds.size() - 1);
+            }
+        });
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int p, r;
+        for (int i = 0; i < 2 * pool.size() && next(p, r); i++) {
+            launch(p, r, seconds.size() - 1);
+        }
+    }
+    pool.wait();
+    return results;
+}
+
+} // namespace
+
+void run(const config& base, const Model& model, const Grid& grid, const ensemble::RunOptions& options,
+         std::ostream& out) {
+    const std::vector<double> betas = grid.betas();
+    const bool adaptive = grid.stopping.active();
+    auto kernel = std::make_shared<const Kernel>(model.infectivity, base.inf_length, base.contact_cache_quantum,
+                                                 base.contact_cache_entries);
+    const bool keep_daily = options.output != ensemble::ReplicaOutput::None;
+    const int max_replicas = (int) betas.size() * (adaptive ? grid.stopping.max_runs : grid.runs);
+    ThreadPool pool(std::min(options.threads, max_replicas));
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<double> seconds;
+    std::vector<PointResult> points =
+        adaptive ? run_adaptive(base, model, kernel, betas, grid.stopping, keep_daily, pool, seconds)
+                 : run_fixed(base, model, kernel, betas, grid.runs, keep_daily, options.longest_first, pool, seconds);
+
+    // Timing goes to stderr: it is the only part of the output that varies between identical runs
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double busy = 0;
+    for (double s : seconds) busy += s;
+    std::cerr << "sweep: " << wall << " s wall, " << busy << " s in " << seconds.size() << " replicas on "
+              << pool.size() << " threads (" << (wall > 0 ? 100.0 * busy / (wall * pool.size()) : 100.0)
+              << "% busy), " << pool.steals() << " steals" << std::endl;
+
+    std::ofstream csv;
+    if (keep_daily) {
+        csv.open(options.output_file);
+        ensemble::DailySummary::write_header(csv, "beta,day");
+    }
+    out << "sweep: " << betas.size() << " points x ";
+    if (adaptive) {
+        out << grid.stopping.min_runs << ".." << grid.stopping.max_runs;
+    } else {
+        out << grid.runs;
+    }
+    out << " runs (N = " << base.N << ", t_max = " << base.t_max << ")" << std::endl;
+    for (size_t p = 0; p < betas.size(); p++) {
+        const ensemble::MetricsSummary& m = points[p].metrics;
+        out << "beta " << std::setw(8) << betas[p] << "   runs " << std::setw(5) << m.runs()
+            << "   attack_rate " << std::setw(10) << m.attack_rate.mean << " +- " << std::setw(10)
+            << 1.96 * m.attack_rate.std_error()
+            << "   peak_day " << std::setw(8) << m.peak_day.mean << " +- " << std::setw(8)
+            << 1.96 * m.peak_day.std_error()
+            << "   peak_cases " << std::setw(10) << m.peak_cases.mean << " +- " << std::setw(10)
+            << 1.96 * m.peak_cases.std_error()
+            << "   second_wave " << std::setw(8) << m.second_wave_probability() << " +- " << std::setw(8)
+            << m.second_wave_half_width() << std::endl;
+        if (keep_daily) {
+            std::ostringstream key;
+            key << betas[p] << ",";
+            points[p].daily.write(csv, key.str());
+        }
+    }
+}
+
+} // namespace epi::sweep
@@ -0,0 +1,35 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "ensemble.h"
+
+namespace epi::sweep {
+
+/// Parameter points of a sweep: beta from `beta_from` to `beta_to` (inclusive) in steps of `beta_step`,
+/// `runs` replicas each.
+struct Grid {
+    double beta_from;
+    double beta_to;
+    double beta_step;
+    int runs;
+    ensemble::StoppingRule stopping; // when active, replaces the fixed `runs` per point
+
+    [[nodiscard]] std::vector<double> betas() const;
+};
+
+/// Reads a sweep file in the format of config.ini (`key = value` lines, `;` comments, [sections] ignored),
+/// overriding the fields of `base` it sets, and returns its grid. Throws std::runtime_error on unreadable files,
+/// malformed lines and unknown keys.
+Grid load_ini(const std::string& path, config& base);
+
+/// Runs every point x run of `grid` in one process, or with an active stopping rule as many runs per point as the
+/// rule needs. Replica r of each point runs on stream base.stream + r
+/// (coupled across points with base.crn). All points share the thread pool and one kernel, as beta does not
+/// enter it. Writes a summary line per point to `out` and, unless options.output is None, the per-day means of
+/// each point to options.output_file as DailySummary rows keyed by `beta,day`.
+void run(const config& base, const Model& model, const Grid& grid, const ensemble::RunOptions& options,
+         std::ostream& out);
+
+} // namespace epi::sweep
@@ -1,13 +1,66 @@
 #include <cmath>
+#include "fastmath.h"
+#include "util.h"
 namespace epi {
 
+namespace detail {
+
+ExpZiggurat::ExpZiggurat() {
+    const double m = 0x1.0p53;
+    const double v = 3.949659822581572e-3; // area of each layer
+    double d = 7.697117470131487;          // right edge of the base layer
+    double t = d;
+    const double q = v / std::exp(-d);
+
+    k[0] = (uint64_t) ((d / q) * m);
+    k[1] = 0;
+    w[0] = q / m;
+    w[255] = d / m;
+    f[0] = 1.0;
+    f[255] = std::exp(-d);
+    for (int i = 254; i >= 1; i--) {
+        d = -std::log(v / d + std::exp(-d));
+        k[i + 1] = (uint64_t) ((d / t) * m);
+        t = d;
+        f[i] = std::exp(-d);
+        w[i] = d / m;
+    }
+}
+
+const ExpZiggurat exp_ziggurat;
+
+double exponential_slow(uint64_t word) {
+    const double r = 7.697117470131487;
+    for (;;) {
+        int i = (int) (word & 0xff);
+        uint64_t j = word >> 11;
+        if (j < exp_ziggurat.k[i]) {
+            return (double) j * exp_ziggurat.w[i];
+        }
+        if (i == 0) { // tail beyond r: memoryless, so r + Exp(1)
+            return r - math::log(uniform());
+        }
+        double x = (double) j * exp_ziggurat.w[i];
+        if (exp_ziggurat.f[i] + uniform() * (exp_ziggurat.f[i - 1] - exp_ziggurat.f[i]) < math::exp(-x)) {
+            return x;
+        }
+        word = rng()();
+    }
+}
+
+} // namespace detail
+
+template <class Math>
 double logn(double x, double s, double m, double k) {
     if (x == 0) {
         return 0;
     }
     double m1 = 1.0 / (x * s * sqrt(2 * M_PI));
-    double t = -pow(log(x) - m, 2) / pow(2 * s, 2);
-    return k * m1 * exp(t);
+    double t = -pow(Math::log(x) - m, 2) / pow(2 * s, 2);
+    return k * m1 * Math::exp(t);
 }
 
+template double logn<math::Precise>(double x, double s, double m, double k);
+template double logn<math::Fast>(double x, double s, double m, double k);
+
 }
@@ -1,20 +1,184 @@
 #pragma once
 
+#include <cmath>
 #include <random>
+#include <vector>
+#include "fastmath.h"
+#include "rng.h"
 
 namespace epi {
 
-static std::mt19937 &mt() {
-    thread_local std::random_device srd;
-    thread_local std::mt19937 smt(srd());
-    return smt;
+/// Fresh 64-bit seed from std::random_device, for runs without an explicit seed.
+inline uint64_t random_seed() {
+    std::random_device rd;
+    return ((uint64_t) rd() << 32) | rd();
 }
 
-static double uniform() {
-    static std::uniform_real_distribution<double> uniform(0, 1);
-    return uniform(mt());
+inline thread_local BlockRng thread_rng;
+
+/// This thread's generator (seed 0, stream 0 until reseed() is called).
+inline BlockRng &rng() {
+    return thread_rng;
+}
+
+/// Points this thread's generator at stream `stream` of `seed` (e.g. stream = replica, or substream(replica, thread)).
+inline void reseed(uint64_t seed, uint64_t stream) {
+    rng().reseed(seed, stream);
+}
+
+/// Installs a run's generator as the thread's RNG for the scope and saves its state back at the end,
+/// so runs can be interleaved on one thread and continued on another
+class RngScope {
+public:
+    explicit RngScope(BlockRng& state) : state_(state) {
+        rng() = state_;
+    }
+    ~RngScope() {
+        state_ = rng();
+    }
+    RngScope(const RngScope&) = delete;
+    RngScope& operator=(const RngScope&) = delete;
+
+private:
+    BlockRng& state_;
+};
+
+inline double uniform() {
+    return to_uniform(rng()());
+}
+
+/// Uniform integer in [0, n) by Lemire's multiply-shift ("Fast random integer generation in an interval", 2019),
+/// unbiased by rejecting the few low products below `threshold` = 2^64 mod n, which callers can precompute.
+inline uint64_t uniform_index(uint64_t n, uint64_t threshold) {
+    __uint128_t m = (__uint128_t) rng()() * n;
+    while ((uint64_t) m < threshold) {
+        m = (__uint128_t) rng()() * n;
+    }
+    return (uint64_t) (m >> 64);
+}
+
+inline uint64_t uniform_index(uint64_t n) {
+    return uniform_index(n, (0 - n) % n);
+}
+
+/// Bulk draws for batch-oriented callers: the same values as n consecutive uniform() calls.
+inline void uniforms(double *out, size_t n) {
+    rng().uniforms(out, n);
+}
+
+inline void random_words(uint64_t *out, size_t n) {
+    rng().fill(out, n);
+}
+
+namespace detail {
+
+/// 256-layer ziggurat for the unit exponential (Marsaglia & Tsang, 2000) on 53-bit integer abscissae.
+struct ExpZiggurat {
+    uint64_t k[256]; // acceptance thresholds: j < k[i] means the point lies inside the layer's rectangle
+    double w[256];   // j * w[i] is the abscissa
+    double f[256];   // exp(-x_i) at the layer edges
+
+    ExpZiggurat();
+};
+
+extern const ExpZiggurat exp_ziggurat;
+
+double exponential_slow(uint64_t word);
+
+} // namespace detail
+
+/// Unit exponential variate. About 98.9% of draws take one random word, a table compare and a multiply;
+/// the rest (wedges and the tail) go to detail::exponential_slow(). While the generator's words are structured
+/// (antithetic or a quasi-random prefix) the word is inverted instead, -log(u), so that paired or stratified words
+/// give paired or stratified exponentials.
+inline double exponential() {
+    const uint64_t word = rng()();
+    if (rng().structured()) {
+        return -math::log(to_uniform(word));
+    }
+    const int i = (int) (word & 0xff);
+    const uint64_t j = word >> 11;
+    if (j < detail::exp_ziggurat.k[i]) {
+        return (double) j * detail::exp_ziggurat.w[i];
+    }
+    return detail::exponential_slow(word);
+}
+
+/// n unit exponentials drawn from one bulk block of random words (slow-path draws take further words).
+inline void exponentials(double *out, size_t n) {
+    thread_local std::vector<uint64_t> words; // all n words are drawn before any slow-path draw
+    words.resize(n);
+    const bool structured = rng().structured(); // before the fill, which may read past a prefix
+    random_words(words.data(), n);
+    if (structured) {
+        for (size_t m = 0; m < n; m++) {
+            out[m] = -math::log(to_uniform(words[m]));
+        }
+        return;
+    }
+    for (size_t m = 0; m < n; m++) {
+        const uint64_t word = words[m];
+        const int i = (int) (word & 0xff);
+        const uint64_t j = word >> 11;
+        out[m] = j < detail::exp_ziggurat.k[i] ? (double) j * detail::exp_ziggurat.w[i]
+                                               : detail::exponential_slow(word);
+    }
+}
+
+/// Standard normal variate (Marsaglia polar method; the second variate of the pair is dropped so that
+/// no state is kept outside the generator).
+inline double normal() {
+    double u, v, s;
+    do {
+        u = 2 * uniform() - 1;
+        v = 2 * uniform() - 1;
+        s = u * u + v * v;
+    } while (s >= 1 || s == 0);
+    return u * std::sqrt(-2 * math::log(s) / s);
+}
+
+/// Poisson variate: sequential inversion (one uniform, O(mean) multiplications) below a mean of 10, above it
+/// Hormann's transformed rejection with squeeze (PTRS, 1993), which takes about 2.3 uniforms whatever the mean.
+inline int poisson(double mean) {
+    if (mean < 10) {
+        int k = 0;
+        double p = math::exp(-mean);
+        double cdf = p;
+        double u = uniform();
+        while (u > cdf && p > 0) {
+            k++;
+            p *= mean / k;
+            cdf += p;
+        }
+        return k;
+    }
+    const double slam = std::sqrt(mean);
+    const double loglam = std::log(mean);
+    const double b = 0.931 + 2.53 * slam;
+    const double a = -0.059 + 0.02483 * b;
+    const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+    const double vr = 0.9277 - 3.6224 / (b - 2);
+    for (;;) {
+        const double u = uniform() - 0.5;
+        const double v = uniform();
+        const double us = 0.5 - std::fabs(u);
+        const double k = std::floor((2 * a / us + b) * u + mean + 0.43);
+        if (us >= 0.07 && v <= vr) {
+            return (int) k;
+        }
+        if (k < 0 || (us < 0.013 && v > us)) {
+            continue;
+        }
+        if (std::log(v) + std::log(invalpha) - std::log(a / (us * us) + b)
+            <= -mean + k * loglam - std::lgamma(k + 1)) {
+            return (int) k;
+        }
+    }
 }
 
+/// Log-normal infectivity curve at x, with the exp and log of `Math` (epi::math::Precise or epi::math::Fast;
+/// instantiated for both in util.cpp).
+template <class Math>
 double logn(double x, double s, double m, double k);
 
 